@@ -0,0 +1,314 @@
+#include <bst_in.cpp>
+#include <bst_pre.cpp>
+#include <bst_post.cpp>
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// Google Benchmark suite for bst_in, bst_pre and bst_post against std::set.
+// Every operation is swept over 1e3 .. 1e7 keys drawn sorted, reverse sorted,
+// uniformly at random or Zipf distributed, for int, uint64_t, std::string and
+// a 64 byte struct. Benchmarks are named op/container/type/distribution/n.
+//
+// The trees do not rebalance, so sorted and reverse input makes them lists
+// with quadratic build time; for those two distributions the trees are only
+// run up to degenerate_cap keys, std::set over the whole sweep.
+//
+// Record a run for regression tracking with
+//     bst_bench --benchmark_out=bst_bench.json --benchmark_out_format=json
+// (the bst_bench_json target does this) and compare two runs with
+// tools/compare.py from the benchmark repository.
+
+static constexpr size_t min_keys = 1000;
+static constexpr size_t max_keys = 10000000;
+static constexpr size_t degenerate_cap = 10000;
+
+struct wide {
+    uint64_t key;
+    char payload[56];
+
+    bool operator<(const wide& other) const { return key < other.key; }
+    bool operator>(const wide& other) const { return key > other.key; }
+    bool operator==(const wide& other) const { return key == other.key; }
+    bool operator!=(const wide& other) const { return key != other.key; }
+};
+static_assert(sizeof(wide) == 64);
+
+enum class distribution { sorted, reverse, random, zipf };
+
+static const char* distribution_name(distribution d) {
+    switch (d) {
+    case distribution::sorted: return "sorted";
+    case distribution::reverse: return "reverse";
+    case distribution::random: return "random";
+    default: return "zipf";
+    }
+}
+
+// n ranks in [0, n) in the order they are inserted. Zipf ranks follow the
+// continuous 1/x law (s = 1), so small ranks repeat and fewer than n distinct
+// keys result.
+static std::vector<uint64_t> make_ranks(distribution d, size_t n) {
+    std::vector<uint64_t> res(n);
+    std::mt19937_64 rng(n);
+    if (d == distribution::zipf) {
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double log_range = std::log(n + 1.0);
+        for (uint64_t& rank : res) rank = std::min<uint64_t>(n - 1, std::exp(uniform(rng) * log_range) - 1);
+        return res;
+    }
+    for (size_t i = 0; i < n; ++i) res[i] = (d == distribution::reverse) ? n - 1 - i : i;
+    if (d == distribution::random) std::shuffle(res.begin(), res.end(), rng);
+    return res;
+}
+
+// Keys keep the order of their ranks for every type.
+template <class T>
+T make_key(uint64_t rank);
+
+template <>
+int make_key<int>(uint64_t rank) {
+    return static_cast<int>(rank);
+}
+
+template <>
+uint64_t make_key<uint64_t>(uint64_t rank) {
+    // Spread over the upper bits so keys do not fit in 32 bits.
+    return rank * 0x9E3779B9ull;
+}
+
+template <>
+std::string make_key<std::string>(uint64_t rank) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "key-%020llu", static_cast<unsigned long long>(rank));
+    return buffer;
+}
+
+template <>
+wide make_key<wide>(uint64_t rank) {
+    wide res{};
+    res.key = rank;
+    return res;
+}
+
+template <class T>
+std::vector<T> make_keys(distribution d, size_t n) {
+    std::vector<T> res;
+    res.reserve(n);
+    for (uint64_t rank : make_ranks(d, n)) res.push_back(make_key<T>(rank));
+    return res;
+}
+
+// Probe order for lookups and erases: the inserted keys, shuffled.
+template <class T>
+std::vector<T> make_probes(const std::vector<T>& keys) {
+    std::vector<T> res(keys);
+    std::mt19937_64 rng(keys.size() + 1);
+    std::shuffle(res.begin(), res.end(), rng);
+    return res;
+}
+
+template <class Tree, class T>
+void fill(Tree& tree, const std::vector<T>& keys) {
+    for (const T& key : keys) tree.insert(key);
+}
+
+template <class Tree, class T>
+void bench_insert(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    for (auto _ : state) {
+        std::optional<Tree> tree(std::in_place);
+        fill(*tree, keys);
+        benchmark::DoNotOptimize(tree->size());
+        state.PauseTiming();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <class Tree, class T>
+void bench_find(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    std::vector<T> probes = make_probes(keys);
+    Tree tree;
+    fill(tree, keys);
+    for (auto _ : state) {
+        size_t hits = 0;
+        for (const T& key : probes) hits += (tree.find(key) != tree.end());
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetItemsProcessed(state.iterations() * probes.size());
+}
+
+// Only bst_in and std::set keep keys in order, so only they have lower_bound.
+template <class Tree, class T>
+constexpr bool has_lower_bound = requires(const Tree& tree, const T& key) { tree.lower_bound(key); };
+
+template <class Tree, class T>
+void bench_lower_bound(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    std::vector<T> probes = make_probes(keys);
+    Tree tree;
+    fill(tree, keys);
+    for (auto _ : state) {
+        size_t hits = 0;
+        for (const T& key : probes) hits += (tree.lower_bound(key) != tree.end());
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetItemsProcessed(state.iterations() * probes.size());
+}
+
+template <class Tree, class T>
+void bench_erase(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    std::vector<T> probes = make_probes(keys);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::optional<Tree> tree(std::in_place);
+        fill(*tree, keys);
+        state.ResumeTiming();
+        size_t erased = 0;
+        for (const T& key : probes) erased += tree->erase(key);
+        benchmark::DoNotOptimize(erased);
+        state.PauseTiming();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * probes.size());
+}
+
+// Full traversal in the container's own order: in-order for bst_in and
+// std::set, pre-order for bst_pre, post-order for bst_post.
+template <class Tree, class T>
+void bench_iterate(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    Tree tree;
+    fill(tree, keys);
+    size_t visited = 0;
+    for (auto _ : state) {
+        visited = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            benchmark::DoNotOptimize(*it);
+            ++visited;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * visited);
+}
+
+template <class Tree, class T>
+void bench_copy(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    Tree tree;
+    fill(tree, keys);
+    for (auto _ : state) {
+        std::optional<Tree> copy(std::in_place, tree);
+        benchmark::DoNotOptimize(copy->size());
+        state.PauseTiming();
+        copy.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Merges a tree holding every other key into one holding the rest.
+template <class Tree, class T>
+void bench_merge(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n), even, odd;
+    for (size_t i = 0; i < keys.size(); ++i) (i % 2 ? odd : even).push_back(keys[i]);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::optional<Tree> target(std::in_place), source(std::in_place);
+        fill(*target, even);
+        fill(*source, odd);
+        state.ResumeTiming();
+        target->merge(*source);
+        benchmark::DoNotOptimize(target->size());
+        state.PauseTiming();
+        target.reset();
+        source.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * odd.size());
+}
+
+template <class Tree, class T>
+void bench_clear(benchmark::State& state, distribution d, size_t n) {
+    std::vector<T> keys = make_keys<T>(d, n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree tree;
+        fill(tree, keys);
+        state.ResumeTiming();
+        tree.clear();
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <class Tree, class T>
+void register_container(const char *container, const char *type, bool degenerate) {
+    typedef void (*bench_function)(benchmark::State&, distribution, size_t);
+    static const struct {
+        const char *name;
+        bench_function run;
+    } ops[] = {
+        {"insert", bench_insert<Tree, T>},
+        {"find", bench_find<Tree, T>},
+        {"lower_bound", nullptr},
+        {"erase", bench_erase<Tree, T>},
+        {"iterate", bench_iterate<Tree, T>},
+        {"copy", bench_copy<Tree, T>},
+        {"merge", bench_merge<Tree, T>},
+        {"clear", bench_clear<Tree, T>},
+    };
+    const distribution distributions[] = {
+        distribution::sorted, distribution::reverse, distribution::random, distribution::zipf
+    };
+
+    for (const auto& op : ops) {
+        bench_function run = op.run;
+        if (std::string(op.name) == "lower_bound") {
+            if constexpr (has_lower_bound<Tree, T>) run = bench_lower_bound<Tree, T>;
+            else continue;
+        }
+        for (distribution d : distributions) {
+            bool ordered = (d == distribution::sorted) || (d == distribution::reverse);
+            for (size_t n = min_keys; n <= max_keys; n *= 10) {
+                if (degenerate && ordered && (n > degenerate_cap)) break;
+                std::string name = std::string(op.name) + "/" + container + "/" + type + "/" +
+                    distribution_name(d) + "/" + std::to_string(n);
+                benchmark::RegisterBenchmark(name.c_str(), [run, d, n](benchmark::State& state) { run(state, d, n); })
+                    ->Unit(benchmark::kMillisecond);
+            }
+        }
+    }
+}
+
+template <class T>
+void register_type(const char *type) {
+    register_container<std::set<T>, T>("std_set", type, false);
+    register_container<bst_in<T>, T>("bst_in", type, true);
+    register_container<bst_pre<T>, T>("bst_pre", type, true);
+    register_container<bst_post<T>, T>("bst_post", type, true);
+}
+
+int main(int argc, char **argv) {
+    register_type<int>("int");
+    register_type<uint64_t>("uint64_t");
+    register_type<std::string>("string");
+    register_type<wide>("wide64");
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <bst_in.cpp>
+#include <bst_concurrent.cpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Multi-threaded stress benchmark: every thread runs a random mix of
+// find / insert / erase over a shared key range for a fixed time and the
+// total throughput is reported for 1..64 threads, next to bst_in guarded by
+// a single global mutex.
+
+struct locked_bst {
+    bst_in<int> tree;
+    std::mutex lock;
+
+    bool contains(int key) {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.contains(key);
+    }
+    void insert(int key) {
+        std::lock_guard<std::mutex> guard(lock);
+        tree.insert(key);
+    }
+    void erase(int key) {
+        std::lock_guard<std::mutex> guard(lock);
+        tree.erase(key);
+    }
+};
+
+template <class Tree>
+double run(Tree& tree, int threads, int key_range, int read_percent, double seconds) {
+    std::atomic<bool> start(false), stop(false);
+    std::atomic<long long> total(0), hits(0);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(12345 + t);
+            std::uniform_int_distribution<int> key(0, key_range - 1), op(0, 99);
+            long long ops = 0, found = 0;
+            while (!start.load()) std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 64; ++i) {
+                    int k = key(rng), o = op(rng);
+                    if (o < read_percent) found += tree.contains(k);
+                    else if (o % 2) tree.insert(k);
+                    else tree.erase(k);
+                }
+                ops += 64;
+            }
+            total.fetch_add(ops);
+            hits.fetch_add(found);
+        });
+    }
+
+    start.store(true);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    for (std::thread& worker : workers) worker.join();
+    // Keeps the lookups observable so they cannot be optimized away.
+    if (hits.load() < 0) std::printf("unreachable\n");
+    return total.load() / seconds;
+}
+
+template <class Tree>
+void prefill(Tree& tree, int key_range) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> key(0, key_range - 1);
+    for (int i = 0; i < key_range / 2; ++i) tree.insert(key(rng));
+}
+
+int main(int argc, char **argv) {
+    int key_range = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    int read_percent = argc > 2 ? std::atoi(argv[2]) : 90;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 1.0;
+
+    std::printf("keys=%d reads=%d%% seconds=%.2f\n", key_range, read_percent, seconds);
+    std::printf("%8s %18s %18s %10s\n", "threads", "bst_concurrent", "bst_in+mutex", "speedup");
+
+    double base = 0;
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        bst_concurrent<int> concurrent;
+        locked_bst locked;
+        prefill(concurrent, key_range);
+        prefill(locked, key_range);
+
+        double a = run(concurrent, threads, key_range, read_percent, seconds);
+        double b = run(locked, threads, key_range, read_percent, seconds);
+        if (threads == 1) base = a;
+        std::printf("%8d %16.0f/s %16.0f/s %9.2fx\n", threads, a, b, a / base);
+    }
+    return 0;
+}
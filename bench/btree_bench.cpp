@@ -0,0 +1,81 @@
+#include <bst_in.cpp>
+#include <btree_in.cpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Single-threaded comparison of bst_in and btree_in on random integer keys:
+// insert throughput, lookup throughput (half hits, half misses), in-order
+// scan and the bytes held by each container, measured with an allocator that
+// counts what it hands out.
+
+static size_t live_bytes = 0;
+
+template <class T>
+struct counting_allocator {
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    counting_allocator() = default;
+    template <class U>
+    counting_allocator(const counting_allocator<U>&) {}
+    T* allocate(size_t n) {
+        live_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        live_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <class U>
+    bool operator==(const counting_allocator<U>&) const { return true; }
+    template <class U>
+    bool operator!=(const counting_allocator<U>&) const { return false; }
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class Tree>
+void run(const char *name, const std::vector<int>& keys, const std::vector<int>& probes) {
+    size_t before = live_bytes;
+    Tree tree;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int key : keys) tree.insert(key);
+    double insert_time = seconds_since(start);
+    size_t bytes = live_bytes - before;
+
+    start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (int key : probes) hits += tree.contains(key);
+    double find_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    long long sum = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) sum += *it;
+    double scan_time = seconds_since(start);
+
+    printf("%-10s %12.0f %12.0f %12.0f %10.1f   (%zu hits, sum %lld)\n", name,
+        keys.size() / insert_time, probes.size() / find_time, tree.size() / scan_time,
+        double(bytes) / tree.size(), hits, sum);
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc > 1) ? atol(argv[1]) : 1000000;
+    std::mt19937 rng(42);
+    std::vector<int> keys(n), probes(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = rng() & 0x7fffffff;
+    for (size_t i = 0; i < n; ++i) probes[i] = (i % 2) ? keys[rng() % n] : int(rng() & 0x7fffffff);
+
+    printf("%zu random int keys\n", n);
+    printf("%-10s %12s %12s %12s %10s\n", "tree", "insert/s", "find/s", "scan/s", "bytes/key");
+    run<bst_in<int, std::less<int>, counting_allocator<int>>>("bst_in", keys, probes);
+    run<btree_in<int, std::less<int>, counting_allocator<int>, 16>>("btree<16>", keys, probes);
+    run<btree_in<int, std::less<int>, counting_allocator<int>, 32>>("btree<32>", keys, probes);
+    run<btree_in<int, std::less<int>, counting_allocator<int>, 64>>("btree<64>", keys, probes);
+    return 0;
+}
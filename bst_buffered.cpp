@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include "bst_in.cpp"
+
+// Write-buffered front end for bst_in. insert and erase only append to a
+// small unsorted log (erase appends a tombstone); once capacity operations
+// are pending the log is sorted, the last operation per key wins, erases are
+// applied and the inserts go in through one insert_bulk. contains and count
+// look at the log newest-first and then at the tree. Everything that hands
+// out tree iterators or needs an exact count flushes first.
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+class bst_buffered {
+private:
+    struct Op {
+        T value;
+        bool erased;
+        Op(const T&, bool);
+    };
+
+public:
+    typedef bst_in<T, C, A> tree_type;
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename tree_type::size_type size_type;
+    typedef typename tree_type::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  A allocator_type;
+    typedef typename tree_type::iterator iterator;
+    using AllocTraits = std::allocator_traits<A>;
+    using OpAlloc = typename AllocTraits::template rebind_alloc<Op>;
+    using OpAllocTraits = typename AllocTraits::template rebind_traits<Op>;
+
+    static constexpr size_t default_capacity = 256;
+
+    explicit bst_buffered(size_t capacity = default_capacity);
+    bst_buffered(const bst_buffered&) = delete;
+    bst_buffered& operator=(const bst_buffered&) = delete;
+    ~bst_buffered();
+
+    void insert(const T&);
+    void erase(const T&);
+    void flush();
+    size_t pending() const;
+    void clear();
+
+    bool contains(const T&) const;
+    size_type count(const T&) const;
+
+    iterator begin();
+    iterator end();
+    iterator find(const T&);
+    iterator lower_bound(const T&);
+    iterator upper_bound(const T&);
+    size_type size();
+    bool empty();
+
+    allocator_type get_allocator() const;
+
+private:
+    tree_type tree_;
+    OpAlloc alloc_;
+    Op *ops_;
+    size_t count_, capacity_;
+};
+
+
+template<class T, class C, class A>
+bst_buffered<T, C, A>::Op::Op(const T& val, bool erase): value(val), erased(erase) {}
+
+template<class T, class C, class A>
+bst_buffered<T, C, A>::bst_buffered(size_t capacity): tree_(), alloc_(), ops_(nullptr), count_(0), capacity_(capacity ? capacity : 1) {
+    ops_ = OpAllocTraits::allocate(alloc_, capacity_);
+}
+
+template<class T, class C, class A>
+bst_buffered<T, C, A>::~bst_buffered() {
+    for (size_t i = 0; i < count_; ++i) OpAllocTraits::destroy(alloc_, ops_ + i);
+    OpAllocTraits::deallocate(alloc_, ops_, capacity_);
+}
+
+template<class T, class C, class A>
+void bst_buffered<T, C, A>::insert(const T& value) {
+    if (count_ == capacity_) flush();
+    OpAllocTraits::construct(alloc_, ops_ + count_, value, false);
+    ++count_;
+}
+
+template<class T, class C, class A>
+void bst_buffered<T, C, A>::erase(const T& key) {
+    if (count_ == capacity_) flush();
+    OpAllocTraits::construct(alloc_, ops_ + count_, key, true);
+    ++count_;
+}
+
+template<class T, class C, class A>
+void bst_buffered<T, C, A>::flush() {
+    if (!count_) return;
+
+    // Stable, so the newest operation on a key is the last of its run.
+    std::stable_sort(ops_, ops_ + count_, [](const Op& a, const Op& b) { return a.value < b.value; });
+
+    A alloc(tree_.get_allocator());
+    T *keys = AllocTraits::allocate(alloc, count_);
+    size_t n = 0;
+    for (size_t i = 0; i < count_; ++i) {
+        if ((i + 1 < count_) && (ops_[i + 1].value == ops_[i].value)) continue;
+        if (ops_[i].erased) tree_.erase(ops_[i].value);
+        else AllocTraits::construct(alloc, keys + n++, ops_[i].value);
+    }
+    tree_.insert_bulk(keys, keys + n);
+
+    for (size_t i = 0; i < n; ++i) AllocTraits::destroy(alloc, keys + i);
+    AllocTraits::deallocate(alloc, keys, count_);
+    for (size_t i = 0; i < count_; ++i) OpAllocTraits::destroy(alloc_, ops_ + i);
+    count_ = 0;
+}
+
+template<class T, class C, class A>
+size_t bst_buffered<T, C, A>::pending() const {
+    return count_;
+}
+
+template<class T, class C, class A>
+void bst_buffered<T, C, A>::clear() {
+    for (size_t i = 0; i < count_; ++i) OpAllocTraits::destroy(alloc_, ops_ + i);
+    count_ = 0;
+    tree_.clear();
+}
+
+template<class T, class C, class A>
+bool bst_buffered<T, C, A>::contains(const T& key) const {
+    for (size_t i = count_; i; --i) {
+        if (ops_[i - 1].value == key) return !ops_[i - 1].erased;
+    }
+    return tree_.contains(key);
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::size_type bst_buffered<T, C, A>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::iterator bst_buffered<T, C, A>::begin() {
+    flush();
+    return tree_.begin();
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::iterator bst_buffered<T, C, A>::end() {
+    flush();
+    return tree_.end();
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::iterator bst_buffered<T, C, A>::find(const T& key) {
+    flush();
+    return tree_.find(key);
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::iterator bst_buffered<T, C, A>::lower_bound(const T& key) {
+    flush();
+    return tree_.lower_bound(key);
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::iterator bst_buffered<T, C, A>::upper_bound(const T& key) {
+    flush();
+    return tree_.upper_bound(key);
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::size_type bst_buffered<T, C, A>::size() {
+    flush();
+    return tree_.size();
+}
+
+template<class T, class C, class A>
+bool bst_buffered<T, C, A>::empty() {
+    flush();
+    return tree_.empty();
+}
+
+template<class T, class C, class A>
+typename bst_buffered<T, C, A>::allocator_type bst_buffered<T, C, A>::get_allocator() const {
+    return tree_.get_allocator();
+}
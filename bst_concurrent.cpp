@@ -0,0 +1,398 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "bst_epoch.cpp"
+
+// Concurrent bst_in variant with per-node locks and optimistic readers.
+// Every node carries a version word: writers set a "changing" bit while they
+// relink the node and then bump the version; unlinking a node also sets the
+// "unlinked" bit for good. Readers take no locks: they read a stable version,
+// read the child link and check the version again, restarting from the root
+// on any conflict. Nodes never move down the tree (there are no rotations),
+// so a validated null link proves the key absent at that instant.
+//
+// erase clears the node's present flag; a node with at most one child is then
+// unlinked by locking its parent and itself (always ancestor first), while a
+// node with two children stays in place as a routing node. Unlinked nodes are
+// freed through epoch-based reclamation. find, insert and erase are
+// linearizable.
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+class bst_concurrent {
+private:
+    struct Node {
+        T value;
+        std::atomic<Node*> left, right, prev;
+        std::atomic<uint64_t> version;
+        std::atomic<bool> present;
+        std::atomic<bool> locked;
+        Node *retired_next;
+        uint64_t retired_epoch;
+        Node(const T& val);
+
+        void lock();
+        void unlock();
+        uint64_t stable_version() const;
+        void begin_change();
+        void end_change();
+    };
+
+    static constexpr uint64_t unlinked_ = 1;
+    static constexpr uint64_t changing_ = 2;
+    static constexpr uint64_t step_ = 4;
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename A::size_type size_type;
+    typedef typename A::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef  A allocator_type;
+    using AllocTraits = std::allocator_traits<A>;
+    using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+    using NodeAllocTraits = typename AllocTraits::template rebind_traits<Node>;
+
+    bst_concurrent();
+    bst_concurrent(const bst_concurrent&) = delete;
+    bst_concurrent& operator=(const bst_concurrent&) = delete;
+    ~bst_concurrent();
+
+    bool insert(const T&);
+    size_type erase(const T&);
+    bool contains(const T&) const;
+    size_type count(const T&) const;
+
+    size_type size() const;
+    bool empty() const;
+    template< class F >
+    void for_each(F) const;
+
+    allocator_type get_allocator() const;
+
+private:
+    // holder_ is a sentinel that is never unlinked; the root is its right child.
+    Node *holder_;
+    std::atomic<size_t> size_;
+    NodeAlloc alloc_;
+    C comp_;
+    mutable bst_epoch epoch_;
+    std::mutex retire_lock_;
+    Node *retired_head_, *retired_tail_;
+    std::atomic<size_t> retired_count_;
+
+    Node* make_node(const T&, Node *);
+    void free_node(Node *);
+    void free_tree(Node *);
+    bool search(const T&, Node *&, Node *&, bool&) const;
+    bool try_unlink(Node *);
+    void retire(Node *);
+    void reclaim();
+    template< class F >
+    static void visit(const Node *, F&);
+};
+
+
+template<class T, class C, class A>
+bst_concurrent<T, C, A>::Node::Node(const T& val):
+    value(val), left(nullptr), right(nullptr), prev(nullptr), version(0), present(true), locked(false),
+    retired_next(nullptr), retired_epoch(0) {}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::Node::lock() {
+    while (locked.exchange(true, std::memory_order_acquire)) {
+        while (locked.load(std::memory_order_relaxed)) std::this_thread::yield();
+    }
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::Node::unlock() {
+    locked.store(false, std::memory_order_release);
+}
+
+template<class T, class C, class A>
+uint64_t bst_concurrent<T, C, A>::Node::stable_version() const {
+    uint64_t v = version.load();
+    while (v & changing_) {
+        std::this_thread::yield();
+        v = version.load();
+    }
+    return v;
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::Node::begin_change() {
+    version.store(version.load() | changing_);
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::Node::end_change() {
+    version.store((version.load() & ~changing_) + step_);
+}
+
+template<class T, class C, class A>
+bst_concurrent<T, C, A>::bst_concurrent():
+    holder_(nullptr), size_(0), alloc_(), comp_(), retired_head_(nullptr), retired_tail_(nullptr), retired_count_(0) {
+    holder_ = make_node(T(), nullptr);
+}
+
+template<class T, class C, class A>
+bst_concurrent<T, C, A>::~bst_concurrent() {
+    free_tree(holder_);
+    for (Node *node = retired_head_; node; ) {
+        Node *next = node->retired_next;
+        free_node(node);
+        node = next;
+    }
+}
+
+template<class T, class C, class A>
+typename bst_concurrent<T, C, A>::Node* bst_concurrent<T, C, A>::make_node(const T& value, Node *prev) {
+    Node *node = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, node, value);
+    node->prev.store(prev);
+    return node;
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::free_node(Node *node) {
+    NodeAllocTraits::destroy(alloc_, node);
+    NodeAllocTraits::deallocate(alloc_, node, 1);
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::free_tree(Node *node) {
+    while (node) {
+        free_tree(node->left.load());
+        Node *right = node->right.load();
+        free_node(node);
+        node = right;
+    }
+}
+
+// Optimistic descent. Returns true with node set to the node holding key, or
+// false with parent set to the node whose validated child link toward key was
+// null (go_left tells which one). The caller must be pinned.
+template<class T, class C, class A>
+bool bst_concurrent<T, C, A>::search(const T& key, Node *&node, Node *&parent, bool& go_left) const {
+    while (true) {
+        bool retry = false;
+        parent = holder_;
+        go_left = false;
+        uint64_t pv = parent->stable_version();
+        node = parent->right.load();
+        if (parent->version.load() != pv) continue;
+
+        while (node) {
+            uint64_t v = node->stable_version();
+            if (v & unlinked_) {
+                retry = true;
+                break;
+            }
+
+            Node *next;
+            if (comp_(key, node->value)) {
+                next = node->left.load();
+                go_left = true;
+            } else if (comp_(node->value, key)) {
+                next = node->right.load();
+                go_left = false;
+            } else {
+                return true;
+            }
+
+            if (node->version.load() != v) {
+                retry = true;
+                break;
+            }
+            parent = node;
+            node = next;
+        }
+        if (!retry) return false;
+    }
+}
+
+template<class T, class C, class A>
+bool bst_concurrent<T, C, A>::contains(const T& key) const {
+    bst_epoch::guard guard(epoch_);
+    while (true) {
+        Node *node, *parent;
+        bool go_left;
+        if (!search(key, node, parent, go_left)) return false;
+
+        uint64_t v = node->stable_version();
+        bool present = node->present.load();
+        if (!(v & unlinked_) && (node->version.load() == v)) return present;
+    }
+}
+
+template<class T, class C, class A>
+typename bst_concurrent<T, C, A>::size_type bst_concurrent<T, C, A>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template<class T, class C, class A>
+bool bst_concurrent<T, C, A>::insert(const T& value) {
+    bst_epoch::guard guard(epoch_);
+    while (true) {
+        Node *node, *parent;
+        bool go_left;
+        if (search(value, node, parent, go_left)) {
+            node->lock();
+            if (node->version.load() & unlinked_) {
+                node->unlock();
+                continue;
+            }
+            bool inserted = !node->present.load();
+            node->present.store(true);
+            node->unlock();
+            if (inserted) size_.fetch_add(1);
+            return inserted;
+        }
+
+        parent->lock();
+        std::atomic<Node*>& link = go_left ? parent->left : parent->right;
+        if ((parent->version.load() & unlinked_) || link.load()) {
+            parent->unlock();
+            continue;
+        }
+        Node *created = make_node(value, parent);
+        parent->begin_change();
+        link.store(created);
+        parent->end_change();
+        parent->unlock();
+        size_.fetch_add(1);
+        return true;
+    }
+}
+
+template<class T, class C, class A>
+typename bst_concurrent<T, C, A>::size_type bst_concurrent<T, C, A>::erase(const T& key) {
+    {
+        bst_epoch::guard guard(epoch_);
+        Node *node, *parent;
+        bool go_left;
+        while (true) {
+            if (!search(key, node, parent, go_left)) return 0;
+            node->lock();
+            if (node->version.load() & unlinked_) {
+                node->unlock();
+                continue;
+            }
+            bool erased = node->present.load();
+            node->present.store(false);
+            node->unlock();
+            if (!erased) return 0;
+            size_.fetch_sub(1);
+            break;
+        }
+
+        // Unlink the erased node, then any routing ancestors it leaves with at
+        // most one child.
+        while ((node != holder_) && try_unlink(node)) node = node->prev.load();
+    }
+    // Scanning the reader slots is not free, so reclaim in batches.
+    if (retired_count_.load() >= 64) reclaim();
+    return 1;
+}
+
+template<class T, class C, class A>
+bool bst_concurrent<T, C, A>::try_unlink(Node *node) {
+    while (true) {
+        Node *parent = node->prev.load();
+        if (!parent) return false;
+        parent->lock();
+        node->lock();
+
+        if (node->version.load() & unlinked_) {
+            node->unlock();
+            parent->unlock();
+            return false;
+        }
+        if ((parent->version.load() & unlinked_) || (node->prev.load() != parent)) {
+            node->unlock();
+            parent->unlock();
+            continue;
+        }
+
+        Node *left = node->left.load(), *right = node->right.load();
+        if (node->present.load() || (left && right)) {
+            node->unlock();
+            parent->unlock();
+            return false;
+        }
+
+        Node *child = left ? left : right;
+        parent->begin_change();
+        node->begin_change();
+        if (parent->left.load() == node) parent->left.store(child);
+        else parent->right.store(child);
+        if (child) child->prev.store(parent);
+        node->version.store(((node->version.load() & ~changing_) | unlinked_) + step_);
+        parent->end_change();
+        node->unlock();
+        parent->unlock();
+        retire(node);
+        return true;
+    }
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::retire(Node *node) {
+    std::lock_guard<std::mutex> lock(retire_lock_);
+    node->retired_epoch = epoch_.advance();
+    node->retired_next = nullptr;
+    if (retired_tail_) retired_tail_->retired_next = node;
+    else retired_head_ = node;
+    retired_tail_ = node;
+    retired_count_.fetch_add(1);
+}
+
+template<class T, class C, class A>
+void bst_concurrent<T, C, A>::reclaim() {
+    std::lock_guard<std::mutex> lock(retire_lock_);
+    while (retired_head_ && epoch_.safe(retired_head_->retired_epoch)) {
+        Node *node = retired_head_;
+        retired_head_ = node->retired_next;
+        free_node(node);
+        retired_count_.fetch_sub(1);
+    }
+    if (!retired_head_) retired_tail_ = nullptr;
+}
+
+template<class T, class C, class A>
+typename bst_concurrent<T, C, A>::size_type bst_concurrent<T, C, A>::size() const {
+    return size_.load();
+}
+
+template<class T, class C, class A>
+bool bst_concurrent<T, C, A>::empty() const {
+    return size() == 0;
+}
+
+template<class T, class C, class A>
+template< class F >
+void bst_concurrent<T, C, A>::visit(const Node *node, F& f) {
+    while (node) {
+        visit(node->left.load(), f);
+        if (node->present.load()) f(node->value);
+        node = node->right.load();
+    }
+}
+
+// Visits present keys in order. Concurrent updates may or may not be seen;
+// the traversal is safe but not a snapshot.
+template<class T, class C, class A>
+template< class F >
+void bst_concurrent<T, C, A>::for_each(F f) const {
+    bst_epoch::guard guard(epoch_);
+    visit(holder_->right.load(), f);
+}
+
+template<class T, class C, class A>
+typename bst_concurrent<T, C, A>::allocator_type bst_concurrent<T, C, A>::get_allocator() const {
+    return alloc_;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+
+// Epoch-based reclamation domain. A reader pins the current epoch in a free
+// slot for the duration of a read; a writer tags every node it unlinks with
+// the epoch returned by advance() and may free it once safe(tag) holds, i.e.
+// once no reader that could still see the node remains pinned.
+class bst_epoch {
+public:
+    static constexpr size_t max_readers = 128;
+
+    class guard {
+    public:
+        guard(bst_epoch&);
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+        ~guard();
+
+    private:
+        bst_epoch *owner_;
+        size_t slot_;
+    };
+
+    bst_epoch();
+    bst_epoch(const bst_epoch&) = delete;
+    bst_epoch& operator=(const bst_epoch&) = delete;
+
+    uint64_t advance();
+    bool safe(uint64_t) const;
+
+private:
+    static constexpr uint64_t idle_ = std::numeric_limits<uint64_t>::max();
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> slots_[max_readers];
+};
+
+
+inline bst_epoch::guard::guard(bst_epoch& owner): owner_(&owner) {
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % max_readers;
+    while (true) {
+        uint64_t epoch = owner_->epoch_.load();
+        for (size_t i = 0; i < max_readers; ++i) {
+            slot_ = (start + i) % max_readers;
+            uint64_t expected = idle_;
+            if (owner_->slots_[slot_].compare_exchange_strong(expected, epoch)) return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline bst_epoch::guard::~guard() {
+    owner_->slots_[slot_].store(idle_);
+}
+
+inline bst_epoch::bst_epoch(): epoch_(0) {
+    for (size_t i = 0; i < max_readers; ++i) slots_[i].store(idle_);
+}
+
+// Call after the new version has been published; nodes unlinked by that
+// update are tagged with the returned value.
+inline uint64_t bst_epoch::advance() {
+    return epoch_.fetch_add(1);
+}
+
+inline bool bst_epoch::safe(uint64_t retired) const {
+    for (size_t i = 0; i < max_readers; ++i) {
+        if (slots_[i].load() <= retired) return false;
+    }
+    return true;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Usage report of a bst_hugepage_arena. huge_bytes is what the kernel
+// currently backs with transparent huge pages inside the arena (AnonHugePages
+// in /proc/self/smaps). huge_objects estimates how many live allocations sit
+// on huge pages from the share of touched arena memory that is huge.
+// fallback_objects counts live small allocations that operator new served
+// because no region could be mapped.
+struct bst_hugepage_stats {
+    size_t reserved_bytes = 0;
+    size_t advised_bytes = 0;
+    size_t touched_bytes = 0;
+    size_t huge_bytes = 0;
+    size_t live_objects = 0;
+    size_t huge_objects = 0;
+    size_t fallback_objects = 0;
+};
+
+// Node arena on huge pages. Memory is reserved in 2 MiB aligned regions with
+// mmap and advised with MADV_HUGEPAGE, then handed out by bumping a pointer;
+// freed objects go to a free list per 16 byte size class and are reused
+// first. Requests above max_object, and every request once mmap has failed
+// or off Linux, fall back to operator new. Regions are unmapped only when
+// the arena goes away.
+class bst_hugepage_arena {
+public:
+    static constexpr size_t huge_page = size_t(2) << 20;
+    static constexpr size_t default_region = size_t(64) << 20;
+    static constexpr size_t max_object = 512;
+
+    explicit bst_hugepage_arena(size_t region_bytes = default_region);
+    bst_hugepage_arena(const bst_hugepage_arena&) = delete;
+    bst_hugepage_arena& operator=(const bst_hugepage_arena&) = delete;
+    ~bst_hugepage_arena();
+
+    void* allocate(size_t bytes, size_t align);
+    void deallocate(void *, size_t bytes, size_t align);
+    bst_hugepage_stats stats() const;
+
+private:
+    static constexpr size_t granule_ = 16;
+
+    // Lives in the first bytes of its own region.
+    struct Region {
+        Region *next;
+        size_t size;
+        bool advised;
+    };
+
+    mutable std::mutex lock_;
+    size_t region_bytes_;
+    Region *regions_;
+    char *cursor_, *limit_;
+    void *free_[max_object / granule_];
+    size_t live_, fallback_, reserved_, advised_;
+    bool mmap_failed_;
+
+    bool owns(const void *) const;
+    bool map_region();
+    static size_t smaps_huge_bytes(const Region *);
+};
+
+
+inline bst_hugepage_arena::bst_hugepage_arena(size_t region_bytes):
+    lock_(), region_bytes_((region_bytes + huge_page - 1) / huge_page * huge_page), regions_(nullptr),
+    cursor_(nullptr), limit_(nullptr), free_(), live_(0), fallback_(0), reserved_(0), advised_(0), mmap_failed_(false) {
+    if (!region_bytes_) region_bytes_ = huge_page;
+}
+
+inline bst_hugepage_arena::~bst_hugepage_arena() {
+#ifdef __linux__
+    while (regions_) {
+        Region *next = regions_->next;
+        munmap(regions_, regions_->size);
+        regions_ = next;
+    }
+#endif
+}
+
+// Maps a new region aligned to the huge page size: a page aligned mapping
+// is cut down to whole huge pages so that the kernel can back all of it.
+inline bool bst_hugepage_arena::map_region() {
+#ifdef __linux__
+    size_t length = region_bytes_ + huge_page;
+    void *raw = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        mmap_failed_ = true;
+        return false;
+    }
+    char *begin = static_cast<char*>(raw);
+    char *base = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(begin) + huge_page - 1) & ~(huge_page - 1));
+    if (base != begin) munmap(begin, base - begin);
+    if (base + region_bytes_ != begin + length) munmap(base + region_bytes_, begin + length - base - region_bytes_);
+
+    Region *region = reinterpret_cast<Region*>(base);
+    region->advised = false;
+#ifdef MADV_HUGEPAGE
+    region->advised = (madvise(base, region_bytes_, MADV_HUGEPAGE) == 0);
+#endif
+    region->size = region_bytes_;
+    region->next = regions_;
+    regions_ = region;
+    reserved_ += region_bytes_;
+    if (region->advised) advised_ += region_bytes_;
+    cursor_ = base + (sizeof(Region) + granule_ - 1) / granule_ * granule_;
+    limit_ = base + region_bytes_;
+    return true;
+#else
+    mmap_failed_ = true;
+    return false;
+#endif
+}
+
+inline bool bst_hugepage_arena::owns(const void *ptr) const {
+    const char *p = static_cast<const char*>(ptr);
+    for (const Region *region = regions_; region; region = region->next) {
+        const char *base = reinterpret_cast<const char*>(region);
+        if ((p >= base) && (p < base + region->size)) return true;
+    }
+    return false;
+}
+
+inline void* bst_hugepage_arena::allocate(size_t bytes, size_t align) {
+    size_t rounded = (bytes + granule_ - 1) / granule_ * granule_;
+    if (!rounded) rounded = granule_;
+    if ((rounded <= max_object) && (align <= granule_)) {
+        std::lock_guard<std::mutex> guard(lock_);
+        void *&head = free_[rounded / granule_ - 1];
+        if (head) {
+            void *res = head;
+            head = *static_cast<void**>(res);
+            ++live_;
+            return res;
+        }
+        if (((limit_ - cursor_) >= static_cast<ptrdiff_t>(rounded)) || (!mmap_failed_ && map_region())) {
+            void *res = cursor_;
+            cursor_ += rounded;
+            ++live_;
+            return res;
+        }
+        ++fallback_;
+    }
+    return ::operator new(bytes, std::align_val_t(align));
+}
+
+inline void bst_hugepage_arena::deallocate(void *ptr, size_t bytes, size_t align) {
+    size_t rounded = (bytes + granule_ - 1) / granule_ * granule_;
+    if (!rounded) rounded = granule_;
+    if ((rounded <= max_object) && (align <= granule_)) {
+        std::lock_guard<std::mutex> guard(lock_);
+        // Without fallbacks every small object came from a region.
+        if (!fallback_ || owns(ptr)) {
+            void *&head = free_[rounded / granule_ - 1];
+            *static_cast<void**>(ptr) = head;
+            head = ptr;
+            --live_;
+            return;
+        }
+        --fallback_;
+    }
+    ::operator delete(ptr, std::align_val_t(align));
+}
+
+// Sums AnonHugePages of the mappings that start inside one of the regions.
+// Only the start of a line is parsed; the rest of a line longer than the
+// buffer (a mapping with a long path) is skipped, not read as a new line.
+inline size_t bst_hugepage_arena::smaps_huge_bytes(const Region *regions) {
+    size_t res = 0;
+#ifdef __linux__
+    FILE *file = std::fopen("/proc/self/smaps", "r");
+    if (!file) return 0;
+    char line[256];
+    bool inside = false, continued = false;
+    while (std::fgets(line, sizeof(line), file)) {
+        bool fragment = continued;
+        continued = !std::strchr(line, '\n');
+        if (fragment) continue;
+        unsigned long start, end, kb;
+        if (std::sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            inside = false;
+            for (const Region *region = regions; region; region = region->next) {
+                uintptr_t base = reinterpret_cast<uintptr_t>(region);
+                if ((start >= base) && (start < base + region->size)) inside = true;
+            }
+        } else if (inside && (std::sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)) {
+            res += kb * 1024;
+        }
+    }
+    std::fclose(file);
+#endif
+    return res;
+}
+
+inline bst_hugepage_stats bst_hugepage_arena::stats() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    bst_hugepage_stats res;
+    res.reserved_bytes = reserved_;
+    res.advised_bytes = advised_;
+    res.touched_bytes = regions_ ? reserved_ - (limit_ - cursor_) : 0;
+    res.huge_bytes = smaps_huge_bytes(regions_);
+    res.live_objects = live_;
+    res.fallback_objects = fallback_;
+    if (res.touched_bytes) {
+        size_t huge = std::min(res.huge_bytes, res.touched_bytes);
+        res.huge_objects = static_cast<size_t>(static_cast<double>(live_) * huge / res.touched_bytes);
+    }
+    return res;
+}
+
+
+// Allocator over a shared bst_hugepage_arena, meant as the A of a tree
+// holding many nodes. A default constructed allocator starts its own arena;
+// copies and rebinds share it, so get_allocator().stats() reports on the
+// tree's arena.
+template <class T>
+class bst_hugepage_allocator {
+public:
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <class U>
+    struct rebind {
+        typedef bst_hugepage_allocator<U> other;
+    };
+
+    bst_hugepage_allocator();
+    explicit bst_hugepage_allocator(std::shared_ptr<bst_hugepage_arena>);
+    template <class U>
+    bst_hugepage_allocator(const bst_hugepage_allocator<U>&);
+
+    T* allocate(size_type);
+    void deallocate(T *, size_type);
+
+    bst_hugepage_stats stats() const;
+    std::shared_ptr<bst_hugepage_arena> arena() const;
+
+    template <class U>
+    bool operator==(const bst_hugepage_allocator<U>&) const;
+    template <class U>
+    bool operator!=(const bst_hugepage_allocator<U>&) const;
+
+private:
+    template <class U>
+    friend class bst_hugepage_allocator;
+
+    std::shared_ptr<bst_hugepage_arena> arena_;
+};
+
+
+template <class T>
+bst_hugepage_allocator<T>::bst_hugepage_allocator(): arena_(std::make_shared<bst_hugepage_arena>()) {}
+
+template <class T>
+bst_hugepage_allocator<T>::bst_hugepage_allocator(std::shared_ptr<bst_hugepage_arena> arena): arena_(std::move(arena)) {}
+
+template <class T>
+template <class U>
+bst_hugepage_allocator<T>::bst_hugepage_allocator(const bst_hugepage_allocator<U>& other): arena_(other.arena_) {}
+
+template <class T>
+T* bst_hugepage_allocator<T>::allocate(size_type n) {
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+}
+
+template <class T>
+void bst_hugepage_allocator<T>::deallocate(T *ptr, size_type n) {
+    arena_->deallocate(ptr, n * sizeof(T), alignof(T));
+}
+
+template <class T>
+bst_hugepage_stats bst_hugepage_allocator<T>::stats() const {
+    return arena_->stats();
+}
+
+template <class T>
+std::shared_ptr<bst_hugepage_arena> bst_hugepage_allocator<T>::arena() const {
+    return arena_;
+}
+
+template <class T>
+template <class U>
+bool bst_hugepage_allocator<T>::operator==(const bst_hugepage_allocator<U>& other) const {
+    return arena_ == other.arena_;
+}
+
+template <class T>
+template <class U>
+bool bst_hugepage_allocator<T>::operator!=(const bst_hugepage_allocator<U>& other) const {
+    return !(*this == other);
+}
@@ -1,24 +1,34 @@
 #pragma once
 
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <algorithm>
+#include <span>
+#include <ranges>
+#include <type_traits>
+#include <optional>
+#include "bst_link.cpp"
+#include "bst_memory.cpp"
+#include <thread>
 
 template <class T, class C = std::less<T>, class A = std::allocator<T>>
 class bst_in {
 private:
     struct Node {
         T value;
-        Node *left, *right, *prev;
+        Node *left, *right;
+        bst_link<Node> prev;
         using allocator_type = A;
         Node(const T& val);
+        Node(const T& val, const A& alloc);
         void swap(Node& other);
     };
 public:
     using key_type = T;
     typedef  T value_type;
-    typedef typename A::size_type size_type;
-    typedef typename A::difference_type difference_type;
+    typedef typename std::allocator_traits<A>::size_type size_type;
+    typedef typename std::allocator_traits<A>::difference_type difference_type;
     typedef  C key_compare;
     typedef  C value_compare;
     typedef  A allocator_type;
@@ -36,7 +46,7 @@ public:
     public:
         Node *node_;
         Node *root_;    
-        typedef typename A::difference_type difference_type;
+        typedef typename std::allocator_traits<A>::difference_type difference_type;
         typedef  T value_type;
         typedef T& reference;
         typedef const typename std::allocator_traits<A>::pointer pointer;
@@ -50,6 +60,8 @@ public:
 
         iterator& operator++();
         iterator& operator--();
+        iterator operator++(int);
+        iterator operator--(int);
 
         reference operator*() const;
         pointer operator->() const;
@@ -59,7 +71,7 @@ public:
     public:
         Node *node_;
         Node *root_;
-        typedef typename A::difference_type difference_type;
+        typedef typename std::allocator_traits<A>::difference_type difference_type;
         typedef  T value_type;
         typedef T& reference;
         typedef const typename std::allocator_traits<A>::pointer pointer;
@@ -75,6 +87,8 @@ public:
 
         const_iterator& operator++();
         const_iterator& operator--();
+        const_iterator operator++(int);
+        const_iterator operator--(int);
 
         reference operator*() const;
         pointer operator->() const;
@@ -84,6 +98,7 @@ public:
     typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
     
     bst_in();
+    explicit bst_in(const A&);
     bst_in(const bst_in&);
     bst_in& operator=(const bst_in&);
     ~bst_in();
@@ -103,8 +118,10 @@ public:
     size_type max_size();
     bool empty();
     allocator_type get_allocator() const;
+    bst_memory_usage memory_usage() const;
     size_t size() const;
     void clear();
+    bool clear_incremental(size_type);
     std::pair<iterator, bool> insert(const value_type&);
     std::pair<iterator, bool> insert(node_type&);
     iterator erase(iterator);
@@ -112,8 +129,18 @@ public:
 
     node_type& extract(iterator);
     node_type& extract(const T&);
+    std::pair<iterator, bool> update_key(iterator, const T&);
     template< class C2 >
     void merge(bst_in<T, C2, A>&);
+    void split(const T&, bst_in&);
+    void join(bst_in&);
+    void relayout();
+    bool compact(size_type);
+    template< class It >
+    size_type insert_bulk(It, It);
+    void set_union(bst_in&);
+    void set_intersection(bst_in&);
+    void set_difference(bst_in&);
 
     size_type count(const T&) const;
     iterator find( const T& );
@@ -129,12 +156,77 @@ public:
     std::pair<iterator, iterator> equal_range( const T& );
     std::pair<const_iterator, const_iterator> equal_range( const T& ) const;
 
+    std::ranges::subrange<iterator> subrange( const T&, const T& );
+
+    size_type copy_to(std::span<T>, const_iterator&) const;
+    template< class F >
+    void for_each_chunk(size_type, F) const;
+
 private:
     Node* root_;
-    size_t size_;
+    // unknown_size_ after split/join until size() counts the nodes. The const
+    // recount caches through atomic_ref, so concurrent const calls are safe.
+    mutable size_t size_;
     NodeAlloc alloc_;
+    Node *reclaim_, *reclaim_list_;
+    // Nodes detached by clear_incremental and not freed yet.
+    size_t reclaim_count_;
+    static constexpr size_t unknown_size_ = std::numeric_limits<size_t>::max();
+
+    // Node blocks made by relayout() and compact(), sorted by address. Nodes
+    // in a block are destroyed one by one and the block is deallocated
+    // together with its last live node.
+    struct chunk {
+        Node *nodes;
+        size_t size, used, live;
+    };
+    chunk *chunks_;
+    size_t chunk_count_, chunk_capacity_;
+    // compact() fills the block at fill_ and resumes after compact_from_.
+    Node *fill_;
+    std::optional<T> compact_from_;
+    // Upper bound on a block, so one block never holds much more than its
+    // live nodes. Whether the heap unmaps a freed block depends on its mmap
+    // threshold, so compact() trims the heap when a pass completes.
+    static constexpr size_t chunk_bytes_ = 256 * 1024;
 
     void node_dfs_destructor(Node *);
+    Node* clone_nodes(const Node *);
+    void destroy_nodes();
+    void unlink_node(Node *);
+    void reclaim_step(Node *&);
+    bool reclaim_pending(size_type);
+    chunk* find_chunk(const Node *) const;
+    Node* add_chunk(size_t);
+    void free_node(Node *);
+    void move_node(Node *, Node *);
+    Node* unblock(Node *);
+    void release_layout();
+    void relocate(Node **, size_t, Node *);
+    static void veb_place(Node *, size_t, Node **, size_t&, Node **, size_t&);
+    static void prefetch(const Node *);
+
+    // Ranges shorter than this are not worth a thread in insert_bulk.
+    static constexpr size_t bulk_grain_ = 4096;
+    static unsigned bulk_depth();
+    static void bulk_sort(T *, size_t, unsigned);
+    static void bulk_mark(const Node *, const T *, size_t, size_t, char *, unsigned);
+    static void bulk_link(Node *&, Node *, const T *, size_t, size_t, Node **, unsigned);
+    static Node* bulk_build(Node *, Node **, size_t, size_t, unsigned);
+
+    // Subtrees dropped by the set operations, queued through the prev link of
+    // their roots and freed by the calling thread once the workers are done.
+    struct detached {
+        Node *head = nullptr, *tail = nullptr;
+    };
+    static void detach(detached&, Node *);
+    static void detach(detached&, detached&);
+    size_type free_detached(detached&);
+    static Node* split_nodes(Node *, const T&, Node *&, Node *&);
+    static Node* join_nodes(Node *, Node *);
+    static void union_nodes(Node *&, Node *, Node *, detached&, unsigned, size_type);
+    static void intersect_nodes(Node *&, Node *, Node *, detached&, unsigned, size_type);
+    static void difference_nodes(Node *&, Node *, Node *, detached&, unsigned, size_type);
 };
 
 template <class T, class C = std::less<T>, class A = std::allocator<T>>
@@ -149,6 +241,15 @@ bst_in<T, C, A>::Node::Node(const T& val) {
     prev = nullptr;
 }
 
+// Used by allocators that construct with the allocator appended, such as
+// std::pmr::polymorphic_allocator; the value gets the allocator in turn.
+template<typename T, typename C, typename A>
+bst_in<T, C, A>::Node::Node(const T& val, const A& alloc): value(std::make_obj_using_allocator<T>(alloc, val)) {
+    left = nullptr;
+    right = nullptr;
+    prev = nullptr;
+}
+
 template<typename T, typename C, typename A>
 void bst_in<T, C, A>::Node::swap(Node& other) {
     if (this == &other) return;
@@ -167,6 +268,7 @@ bst_in<T, C, A>::iterator::iterator(const iterator& other): node_(other.node_),
 template<typename T, typename C, typename A>
 typename bst_in<T, C, A>::iterator& bst_in<T, C, A>::iterator::operator=(const iterator& other) {
     node_ = other.node_;
+    root_ = other.root_;
     return *this;
 }
 
@@ -216,6 +318,20 @@ typename bst_in<T,C,A>::iterator& bst_in<T,C,A>::iterator::operator--() {
     return *this;
 }
 
+template<typename T, typename C, typename A>
+typename bst_in<T,C,A>::iterator bst_in<T,C,A>::iterator::operator++(int) {
+    iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<typename T, typename C, typename A>
+typename bst_in<T,C,A>::iterator bst_in<T,C,A>::iterator::operator--(int) {
+    iterator res(*this);
+    --(*this);
+    return res;
+}
+
 template<typename T, typename C, typename A>
 typename bst_in<T,C,A>::iterator::reference bst_in<T,C,A>::iterator::operator*() const {
     return node_->value;
@@ -239,6 +355,7 @@ bst_in<T, C, A>::const_iterator::const_iterator(const iterator& other): node_(ot
 template<typename T, typename C, typename A>
 typename bst_in<T, C, A>::const_iterator& bst_in<T, C, A>::const_iterator::operator=(const const_iterator& other) {
     node_ = other.node_;
+    root_ = other.root_;
     return *this;
 }
 
@@ -288,6 +405,20 @@ typename bst_in<T,C,A>::const_iterator& bst_in<T,C,A>::const_iterator::operator-
     return *this;
 }
 
+template<typename T, typename C, typename A>
+typename bst_in<T,C,A>::const_iterator bst_in<T,C,A>::const_iterator::operator++(int) {
+    const_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<typename T, typename C, typename A>
+typename bst_in<T,C,A>::const_iterator bst_in<T,C,A>::const_iterator::operator--(int) {
+    const_iterator res(*this);
+    --(*this);
+    return res;
+}
+
 template<typename T, typename C, typename A>
 typename bst_in<T,C,A>::const_iterator::reference bst_in<T,C,A>::const_iterator::operator*() const {
     return node_->value;
@@ -298,35 +429,114 @@ typename bst_in<T,C,A>::const_iterator::pointer bst_in<T,C,A>::const_iterator::o
 }
 
 template<typename T, typename C, typename A>
-bst_in<T,C,A>::bst_in(): root_(nullptr), size_(0), alloc_() {}
+bst_in<T,C,A>::bst_in(): root_(nullptr), size_(0), alloc_(), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0),
+    chunks_(nullptr), chunk_count_(0), chunk_capacity_(0), fill_(nullptr), compact_from_() {}
 
 template<typename T, typename C, typename A>
-bst_in<T,C,A>::bst_in(const bst_in& other) {
-    root_ = other.root_;
-    size_ = other.size_;
-    alloc_ = other.alloc_;
+bst_in<T,C,A>::bst_in(const A& alloc): root_(nullptr), size_(0), alloc_(alloc), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0),
+    chunks_(nullptr), chunk_count_(0), chunk_capacity_(0), fill_(nullptr), compact_from_() {}
+
+template<typename T, typename C, typename A>
+bst_in<T,C,A>::bst_in(const bst_in& other): root_(nullptr), size_(other.size_), alloc_(other.alloc_), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0),
+    chunks_(nullptr), chunk_count_(0), chunk_capacity_(0), fill_(nullptr), compact_from_() {
+    root_ = clone_nodes(other.root_);
 }
 
 template<class T, class C, class A>
 bst_in<T, C, A>& bst_in<T, C, A>::operator=(const bst_in<T, C, A> &other) {
     if (this == &other) return *this;
-    root_ = other.root_;
+    clear();
+    root_ = clone_nodes(other.root_);
     size_ = other.size_;
-    alloc_ = other.alloc_;
+    return *this;
+}
+
+// Copies the tree below node shape for shape, walking it through the prev
+// links: a node's copy gets its left, then its right child before the walk
+// moves back up.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::clone_nodes(const Node *node) {
+    if (!node) return nullptr;
+    Node *res = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, res, node->value);
+    const Node *from = node;
+    Node *to = res;
+    while (true) {
+        const Node *child = nullptr;
+        if (from->left && !to->left) child = from->left;
+        else if (from->right && !to->right) child = from->right;
+        if (child) {
+            Node *copy = NodeAllocTraits::allocate(alloc_, 1);
+            NodeAllocTraits::construct(alloc_, copy, child->value);
+            copy->prev = to;
+            if (child == from->left) to->left = copy;
+            else to->right = copy;
+            from = child;
+            to = copy;
+        } else if (from == node) {
+            break;
+        } else {
+            from = from->prev;
+            to = to->prev;
+        }
+    }
+    return res;
 }
 
 template<typename T, typename C, typename A>
 void bst_in<T, C, A>::node_dfs_destructor(Node *node) {
-    if (!node) return;
-    node_dfs_destructor(node->left);
-    node_dfs_destructor(node->right);
-    NodeAllocTraits::destroy(alloc_, node);
-    NodeAllocTraits::deallocate(alloc_, node, 1);
+    while (node) reclaim_step(node);
+}
+
+// Frees the tree below node with O(1) extra space: a left child is rotated up,
+// a node without one is freed and node moves on to its right child.
+template<typename T, typename C, typename A>
+void bst_in<T, C, A>::reclaim_step(Node *&node) {
+    if (node->left) {
+        Node *left = node->left;
+        node->left = left->right;
+        left->right = node;
+        node = left;
+    } else {
+        Node *right = node->right;
+        free_node(node);
+        node = right;
+    }
 }
 
 template<class T, class C, class A>
 bst_in<T,C,A>::~bst_in() {
-    node_dfs_destructor(root_);
+    // Memory from a monotonic resource goes back only with the resource, so
+    // nodes are just destroyed, and not even visited for trivially
+    // destructible T.
+    if (bst_monotonic(alloc_)) {
+        if constexpr (!std::is_trivially_destructible_v<T>) destroy_nodes();
+        return;
+    }
+    clear_incremental(std::numeric_limits<size_type>::max());
+}
+
+// Runs the value destructors of all nodes, pending ones included, without
+// deallocating them; the walk rotates left children up like reclaim_step.
+template<class T, class C, class A>
+void bst_in<T,C,A>::destroy_nodes() {
+    clear_incremental(0);
+    while (reclaim_ || reclaim_list_) {
+        if (!reclaim_) {
+            reclaim_ = reclaim_list_;
+            reclaim_list_ = reclaim_->prev;
+        }
+        if (reclaim_->left) {
+            Node *left = reclaim_->left;
+            reclaim_->left = left->right;
+            left->right = reclaim_;
+            reclaim_ = left;
+        } else {
+            Node *right = reclaim_->right;
+            NodeAllocTraits::destroy(alloc_, reclaim_);
+            reclaim_ = right;
+        }
+    }
 }
 
 template<class T, class C, class A>
@@ -395,13 +605,21 @@ void bst_in<T,C,A>::swap(bst_in& other) {
     std::swap(alloc_, other.alloc_);
     std::swap(root_, other.root_);
     std::swap(size_, other.size_);
+    std::swap(reclaim_, other.reclaim_);
+    std::swap(reclaim_list_, other.reclaim_list_);
+    std::swap(reclaim_count_, other.reclaim_count_);
+    std::swap(chunks_, other.chunks_);
+    std::swap(chunk_count_, other.chunk_count_);
+    std::swap(chunk_capacity_, other.chunk_capacity_);
+    std::swap(fill_, other.fill_);
+    std::swap(compact_from_, other.compact_from_);
 }
 
 template<class T, class C, class A>
 typename bst_in<T,C,A>::size_type bst_in<T,C,A>::max_size() {return std::numeric_limits<difference_type>::max();}
 
 template<class T, class C, class A>
-bool bst_in<T,C,A>::empty() {return size_ == 0;}
+bool bst_in<T,C,A>::empty() {return !root_;}
 
 template<class T, class C, class A>
 typename bst_in<T,C,A>::allocator_type bst_in<T,C,A>::get_allocator() const {
@@ -409,7 +627,43 @@ typename bst_in<T,C,A>::allocator_type bst_in<T,C,A>::get_allocator() const {
 }
 
 template<class T, class C, class A>
-size_t bst_in<T,C,A>::size() const {return size_;}
+bst_memory_usage bst_in<T,C,A>::memory_usage() const {
+    bst_memory_usage res;
+    res.nodes = size();
+    res.node_bytes = res.nodes * sizeof(Node);
+    res.value_bytes = res.nodes * sizeof(T);
+    size_t separate = res.nodes + reclaim_count_;
+    for (size_t i = 0; i < chunk_count_; ++i) {
+        separate -= chunks_[i].live;
+        res.slack_bytes += (chunks_[i].size - chunks_[i].live) * sizeof(Node);
+        res.slack_bytes += bst_allocation_slack(chunks_[i].size * sizeof(Node));
+    }
+    res.slack_bytes += separate * bst_allocation_slack(sizeof(Node));
+    res.auxiliary_bytes = sizeof(*this) + reclaim_count_ * sizeof(Node) + chunk_capacity_ * sizeof(chunk);
+    return res;
+}
+
+template<class T, class C, class A>
+size_t bst_in<T,C,A>::size() const {
+    std::atomic_ref<size_t> cached(size_);
+    size_t res = cached.load(std::memory_order_relaxed);
+    if (res != unknown_size_) return res;
+    res = 0;
+    const Node *node = root_;
+    while (node && node->left) node = node->left;
+    while (node) {
+        ++res;
+        if (node->right) {
+            node = node->right;
+            while (node->left) node = node->left;
+        } else {
+            while (node->prev && (node->prev->right == node)) node = node->prev;
+            node = node->prev;
+        }
+    }
+    cached.store(res, std::memory_order_relaxed);
+    return res;
+}
 
 template<class T, class C, class A>
 void bst_in<T,C,A>::clear() {
@@ -418,6 +672,35 @@ void bst_in<T,C,A>::clear() {
     root_ = nullptr;
 }
 
+// Detaches the current contents in O(1) and then spends at most budget steps
+// (one rotation or one free each) on detached nodes. Detached trees are queued
+// through the prev link of their roots. Returns true once nothing is pending.
+template<class T, class C, class A>
+bool bst_in<T,C,A>::clear_incremental(size_type budget) {
+    if (root_) {
+        reclaim_count_ += size();
+        root_->prev = reclaim_list_;
+        reclaim_list_ = root_;
+        root_ = nullptr;
+        size_ = 0;
+    }
+    return reclaim_pending(budget);
+}
+
+template<class T, class C, class A>
+bool bst_in<T,C,A>::reclaim_pending(size_type budget) {
+    for (; budget; --budget) {
+        if (!reclaim_) {
+            if (!reclaim_list_) break;
+            reclaim_ = reclaim_list_;
+            reclaim_list_ = reclaim_->prev;
+        }
+        if (!reclaim_->left) --reclaim_count_;
+        reclaim_step(reclaim_);
+    }
+    return !reclaim_ && !reclaim_list_;
+}
+
 template<class T, class C, class A>
 std::pair<typename bst_in<T,C,A>::iterator, bool> bst_in<T,C,A>::insert(const value_type& value) {
     iterator v;
@@ -434,10 +717,10 @@ std::pair<typename bst_in<T,C,A>::iterator, bool> bst_in<T,C,A>::insert(const va
 
     if (v.node_) return {v, false};
     else {
-        size_++;
+        if (size_ != unknown_size_) size_++;
         Node *node = NodeAllocTraits::allocate(alloc_, 1);
         NodeAllocTraits::construct(alloc_, node, value);
-        if (size_ == 1) root_ = node;
+        if (!prev.node_) root_ = node;
         v.node_ = node;
         node->prev = prev.node_;
         if (prev.node_ && (*prev < value)) prev.node_->right = node;
@@ -462,8 +745,8 @@ std::pair<typename bst_in<T,C,A>::iterator, bool> bst_in<T,C,A>::insert(node_typ
 
     if (v.node_) return {v, false};
     else {
-        size_++;
-        if (size_ == 1) root_ = &node;
+        if (size_ != unknown_size_) size_++;
+        if (!prev.node_) root_ = &node;
         v.node_ = &node;
         node.prev = prev.node_;
         if (prev.node_ && (*prev < node.value)) prev.node_->right = &node;
@@ -475,201 +758,536 @@ std::pair<typename bst_in<T,C,A>::iterator, bool> bst_in<T,C,A>::insert(node_typ
 template<class T, class C, class A>
 typename bst_in<T,C,A>::iterator bst_in<T,C,A>::erase(iterator pos) {
     if (!pos.node_) return pos;
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        NodeAllocTraits::destroy(alloc_, next.node_);
-        NodeAllocTraits::deallocate(alloc_, next.node_, 1);
-        return pos;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+    iterator next(pos);
+    ++next;
+    unlink_node(pos.node_);
+    if (size_ != unknown_size_) size_--;
+    free_node(pos.node_);
+    next.root_ = root_;
+    return next;
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::size_type bst_in<T,C,A>::erase(const T& key) {
+    iterator pos = find(key);
+    if (!pos.node_) return 0;
+    erase(pos);
+    return 1;
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::node_type& bst_in<T,C,A>::extract(iterator pos) {
+    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
+    unlink_node(pos.node_);
+    if (size_ != unknown_size_) size_--;
+    return *unblock(pos.node_);
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::node_type& bst_in<T,C,A>::extract(const T& key) {
+    iterator pos = find(key);
+    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
+    return extract(pos);
+}
+
+// Takes node out of the tree without freeing it, relinking its in-order
+// successor into its place when it has two children.
+template<class T, class C, class A>
+void bst_in<T,C,A>::unlink_node(Node *node) {
+    Node *child = node->left ? node->left : node->right;
+    if (node->left && node->right) {
+        child = node->right;
+        while (child->left) child = child->left;
+        if (child != node->right) {
+            child->prev->left = child->right;
+            if (child->right) child->right->prev = child->prev;
+            child->right = node->right;
+            node->right->prev = child;
         }
-        pos.node_->left->prev = pos.node_->prev;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-        return next;
-    } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-        return next;
+        child->left = node->left;
+        node->left->prev = child;
     }
+    if (child) child->prev = node->prev;
+    if (!node->prev) root_ = child;
+    else if (node->prev->left == node) node->prev->left = child;
+    else node->prev->right = child;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->prev = nullptr;
 }
 
+// Gives the element at pos the key value, reusing its node: no allocation,
+// and pos stays valid. If value still lies between the in-order neighbours
+// the key is rewritten in place; otherwise the node is unlinked and linked
+// back in at its new position. Returns false, with the tree unchanged and an
+// iterator to the other element, if value is already present elsewhere.
 template<class T, class C, class A>
-typename bst_in<T,C,A>::size_type bst_in<T,C,A>::erase(const T& key) {
+std::pair<typename bst_in<T,C,A>::iterator, bool> bst_in<T,C,A>::update_key(iterator pos, const T& value) {
+    Node *node = pos.node_;
+    if (!node) return {pos, false};
 
-    iterator pos;
-    pos.node_ = root_; pos.root_ = root_;
+    Node *lo = node->left, *hi = node->right;
+    if (lo) {
+        while (lo->right) lo = lo->right;
+    } else {
+        lo = node;
+        while (lo->prev && (lo->prev->left == lo)) lo = lo->prev;
+        lo = lo->prev;
+    }
+    if (hi) {
+        while (hi->left) hi = hi->left;
+    } else {
+        hi = node;
+        while (hi->prev && (hi->prev->right == hi)) hi = hi->prev;
+        hi = hi->prev;
+    }
+    if ((!lo || (lo->value < value)) && (!hi || (value < hi->value))) {
+        node->value = value;
+        return {pos, true};
+    }
 
-    while (pos.node_ && (*pos != key)) {
-        if (*pos > key) pos.node_ = pos.node_->left;
-        else pos.node_ = pos.node_->right;
+    iterator same = find(value);
+    if (same.node_) return {same, false};
+
+    unlink_node(node);
+    node->value = value;
+    Node *parent = nullptr, **link = &root_;
+    while (*link) {
+        parent = *link;
+        link = (value < parent->value) ? &parent->left : &parent->right;
     }
+    *link = node;
+    node->prev = parent;
+    pos.root_ = root_;
+    return {pos, true};
+}
 
-    if (!pos.node_) return 0;
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
+template<class T, class C, class A>
+template< class C2 >
+void bst_in<T,C,A>::merge(bst_in<T,C2,A>& source) {
+    while (!source.empty()) {
+        insert(source.extract(source.begin()));
+    }
+}
+
+// Inserts [first, last) and returns the number of keys that were not present.
+// The batch is copied, sorted and deduplicated in parallel, keys already in
+// the tree are found by splitting the batch at each node on the way down
+// (disjoint subtrees are handled by separate threads), nodes for the new keys
+// are allocated in one pass, and each run of new keys that lands on an empty
+// link is hung there as a balanced subtree.
+template<class T, class C, class A>
+template< class It >
+typename bst_in<T,C,A>::size_type bst_in<T,C,A>::insert_bulk(It first, It last) {
+    size_t n = std::distance(first, last);
+    if (!n) return 0;
+
+    A alloc(alloc_);
+    T *keys = AllocTraits::allocate(alloc, n);
+    for (size_t i = 0; i < n; ++i, ++first) AllocTraits::construct(alloc, keys + i, *first);
+
+    unsigned depth = bulk_depth();
+    bulk_sort(keys, n, depth);
+    size_t unique = std::unique(keys, keys + n) - keys;
+
+    using CharAlloc = typename AllocTraits::template rebind_alloc<char>;
+    CharAlloc char_alloc(alloc_);
+    char *present = std::allocator_traits<CharAlloc>::allocate(char_alloc, unique);
+    std::fill(present, present + unique, 0);
+    bulk_mark(root_, keys, 0, unique, present, depth);
+
+    size_t added = 0;
+    for (size_t i = 0; i < unique; ++i) {
+        if (!present[i]) {
+            if (added != i) keys[added] = keys[i];
+            ++added;
         }
-        NodeAllocTraits::destroy(alloc_, next.node_);
-        NodeAllocTraits::deallocate(alloc_, next.node_, 1);
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+    }
+    std::allocator_traits<CharAlloc>::deallocate(char_alloc, present, unique);
+
+    if (added) {
+        using PtrAlloc = typename AllocTraits::template rebind_alloc<Node*>;
+        PtrAlloc ptr_alloc(alloc_);
+        Node **pool = std::allocator_traits<PtrAlloc>::allocate(ptr_alloc, added);
+        for (size_t i = 0; i < added; ++i) {
+            pool[i] = NodeAllocTraits::allocate(alloc_, 1);
+            NodeAllocTraits::construct(alloc_, pool[i], keys[i]);
         }
-        pos.node_->left->prev = pos.node_->prev;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-    } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
+        bulk_link(root_, nullptr, keys, 0, added, pool, depth);
+        std::allocator_traits<PtrAlloc>::deallocate(ptr_alloc, pool, added);
+        if (size_ != unknown_size_) size_ += added;
     }
-    return 1;
+
+    for (size_t i = 0; i < n; ++i) AllocTraits::destroy(alloc, keys + i);
+    AllocTraits::deallocate(alloc, keys, n);
+    return added;
 }
 
+// How many times the bulk helpers may fork before running serially.
 template<class T, class C, class A>
-typename bst_in<T,C,A>::node_type& bst_in<T,C,A>::extract(iterator pos) {
-    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        return *next.node_;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+unsigned bst_in<T,C,A>::bulk_depth() {
+    unsigned depth = 0;
+    for (unsigned threads = std::thread::hardware_concurrency(); threads > 1; threads >>= 1) ++depth;
+    return depth;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::bulk_sort(T *keys, size_t n, unsigned depth) {
+    if (!depth || (n < bulk_grain_)) {
+        std::sort(keys, keys + n);
+        return;
+    }
+    size_t half = n / 2;
+    std::thread left([=] { bulk_sort(keys, half, depth - 1); });
+    bulk_sort(keys + half, n - half, depth - 1);
+    left.join();
+    std::inplace_merge(keys, keys + half, keys + n);
+}
+
+// Sets present[i] for every key in [lo, hi) that is already in the subtree.
+template<class T, class C, class A>
+void bst_in<T,C,A>::bulk_mark(const Node *node, const T *keys, size_t lo, size_t hi, char *present, unsigned depth) {
+    while (node && (lo < hi)) {
+        size_t mid = std::lower_bound(keys + lo, keys + hi, node->value) - keys;
+        size_t right = mid;
+        if ((mid < hi) && (keys[mid] == node->value)) present[right++] = 1;
+
+        if (depth && (mid - lo >= bulk_grain_) && (hi - right >= bulk_grain_)) {
+            std::thread left([=] { bulk_mark(node->left, keys, lo, mid, present, depth - 1); });
+            bulk_mark(node->right, keys, right, hi, present, depth - 1);
+            left.join();
+            return;
         }
-        pos.node_->left->prev = pos.node_->prev;
-        return *pos.node_;
+        bulk_mark(node->left, keys, lo, mid, present, depth);
+        node = node->right;
+        lo = right;
+    }
+}
+
+// Links pool[lo, hi), whose keys are all new, into the subtree at link.
+template<class T, class C, class A>
+void bst_in<T,C,A>::bulk_link(Node *&link, Node *prev, const T *keys, size_t lo, size_t hi, Node **pool, unsigned depth) {
+    if (lo == hi) return;
+    Node *node = link;
+    if (!node) {
+        link = bulk_build(prev, pool, lo, hi, depth);
+        return;
+    }
+
+    size_t mid = std::lower_bound(keys + lo, keys + hi, node->value) - keys;
+    if (depth && (mid - lo >= bulk_grain_) && (hi - mid >= bulk_grain_)) {
+        std::thread left([=] { bulk_link(node->left, node, keys, lo, mid, pool, depth - 1); });
+        bulk_link(node->right, node, keys, mid, hi, pool, depth - 1);
+        left.join();
+        return;
+    }
+    bulk_link(node->left, node, keys, lo, mid, pool, depth);
+    bulk_link(node->right, node, keys, mid, hi, pool, depth);
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::bulk_build(Node *prev, Node **pool, size_t lo, size_t hi, unsigned depth) {
+    if (lo == hi) return nullptr;
+    size_t mid = lo + (hi - lo) / 2;
+    Node *node = pool[mid];
+    node->prev = prev;
+    if (depth && (hi - lo >= 2 * bulk_grain_)) {
+        std::thread left([=] { node->left = bulk_build(node, pool, lo, mid, depth - 1); });
+        node->right = bulk_build(node, pool, mid + 1, hi, depth - 1);
+        left.join();
     } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        return *pos.node_;
+        node->left = bulk_build(node, pool, lo, mid, depth);
+        node->right = bulk_build(node, pool, mid + 1, hi, depth);
     }
+    return node;
 }
 
+// The set operations below consume other: every node ends up either in *this
+// or freed, and other is left empty. Each step splits other at the key of the
+// current node of *this and recurses into both sides, so the work is
+// O(m log(n/m + 1)) comparisons on balanced trees and the two sides run on
+// separate threads near the top. Subtree sizes are not tracked, so work
+// starts as the smaller input size and halves at each level; a step forks
+// only while both halves are at least bulk_grain_, as insert_bulk does.
 template<class T, class C, class A>
-typename bst_in<T,C,A>::node_type& bst_in<T,C,A>::extract(const T& key) {
+void bst_in<T,C,A>::set_union(bst_in& other) {
+    if (this == &other) return;
+    other.release_layout();
+    size_t total = size() + other.size();
+    detached garbage;
+    union_nodes(root_, nullptr, other.root_, garbage, bulk_depth(), std::min(size(), other.size()));
+    size_ = total - free_detached(garbage);
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
 
-    iterator pos;
-    pos.node_ = root_; pos.root_ = root_;
+template<class T, class C, class A>
+void bst_in<T,C,A>::set_intersection(bst_in& other) {
+    if (this == &other) return;
+    other.release_layout();
+    size_t total = size() + other.size();
+    detached garbage;
+    intersect_nodes(root_, nullptr, other.root_, garbage, bulk_depth(), std::min(size(), other.size()));
+    size_ = total - free_detached(garbage);
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
 
-    while (pos.node_ && (*pos != key)) {
-        if (*pos > key) pos.node_ = pos.node_->left;
-        else pos.node_ = pos.node_->right;
+template<class T, class C, class A>
+void bst_in<T,C,A>::set_difference(bst_in& other) {
+    if (this == &other) {
+        clear();
+        return;
     }
+    other.release_layout();
+    size_t total = size() + other.size();
+    detached garbage;
+    difference_nodes(root_, nullptr, other.root_, garbage, bulk_depth(), std::min(size(), other.size()));
+    size_ = total - free_detached(garbage);
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
 
-    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
+// Moves every key not less than key into greater, relinking O(h) nodes;
+// greater's previous contents are released. Sizes are recounted lazily.
+template<class T, class C, class A>
+void bst_in<T,C,A>::split(const T& key, bst_in& greater) {
+    if (this == &greater) return;
+    greater.clear();
+    if (!root_) return;
+    release_layout();
+
+    size_t total = size_;
+    Node *less, *not_less;
+    Node *equal = split_nodes(root_, key, less, not_less);
+    if (equal) {
+        Node *min = not_less;
+        while (min && min->left) min = min->left;
+        equal->prev = min;
+        if (min) min->left = equal;
+        else not_less = equal;
+    }
+    root_ = less;
+    greater.root_ = not_less;
+    size_ = root_ ? unknown_size_ : 0;
+    greater.size_ = greater.root_ ? unknown_size_ : 0;
+    if (!root_) greater.size_ = total;
+    else if (!greater.root_) size_ = total;
+}
+
+// Appends other when the key ranges of the two trees do not overlap, lifting
+// the maximum of the lower tree into the root in O(h); otherwise falls back
+// to merge. other is left empty.
+template<class T, class C, class A>
+void bst_in<T,C,A>::join(bst_in& other) {
+    if ((this == &other) || !other.root_) return;
+    other.release_layout();
+    if (!root_) {
+        root_ = other.root_;
+        size_ = other.size_;
+        other.root_ = nullptr;
+        other.size_ = 0;
+        return;
+    }
+
+    const Node *max = root_, *other_min = other.root_;
+    while (max->right) max = max->right;
+    while (other_min->left) other_min = other_min->left;
+    const Node *min = root_, *other_max = other.root_;
+    while (min->left) min = min->left;
+    while (other_max->right) other_max = other_max->right;
+
+    if (max->value < other_min->value) {
+        root_ = join_nodes(root_, other.root_);
+    } else if (other_max->value < min->value) {
+        root_ = join_nodes(other.root_, root_);
+    } else {
+        set_union(other);
+        return;
+    }
+    if ((size_ == unknown_size_) || (other.size_ == unknown_size_)) size_ = unknown_size_;
+    else size_ += other.size_;
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::detach(detached& list, Node *node) {
+    if (!node) return;
+    node->prev = nullptr;
+    if (list.tail) list.tail->prev = node;
+    else list.head = node;
+    list.tail = node;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::detach(detached& list, detached& other) {
+    if (!other.head) return;
+    if (list.tail) list.tail->prev = other.head;
+    else list.head = other.head;
+    list.tail = other.tail;
+    other.head = other.tail = nullptr;
+}
+
+// Frees every queued subtree and returns the number of nodes freed.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::size_type bst_in<T,C,A>::free_detached(detached& list) {
+    size_type freed = 0;
+    Node *node = list.head;
+    while (node) {
+        Node *next = node->prev;
+        while (node) {
+            if (!node->left) ++freed;
+            reclaim_step(node);
         }
-        return next.node_;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+        node = next;
+    }
+    list.head = list.tail = nullptr;
+    return freed;
+}
+
+// Splits the subtree at node into keys less than key (left) and greater than
+// key (right), relinking nodes top-down. Returns the node equal to key with
+// its links cleared, or nullptr.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::split_nodes(Node *node, const T& key, Node *&left, Node *&right) {
+    Node **left_link = &left, **right_link = &right;
+    Node *left_prev = nullptr, *right_prev = nullptr;
+    while (node) {
+        if (node->value < key) {
+            *left_link = node;
+            node->prev = left_prev;
+            left_prev = node;
+            left_link = &node->right;
+            node = node->right;
+        } else if (node->value > key) {
+            *right_link = node;
+            node->prev = right_prev;
+            right_prev = node;
+            right_link = &node->left;
+            node = node->left;
+        } else {
+            *left_link = node->left;
+            if (node->left) node->left->prev = left_prev;
+            *right_link = node->right;
+            if (node->right) node->right->prev = right_prev;
+            node->left = node->right = node->prev = nullptr;
+            return node;
         }
-        pos.node_->left->prev = pos.node_->prev;
-        return pos.node_;
+    }
+    *left_link = nullptr;
+    *right_link = nullptr;
+    return nullptr;
+}
+
+// Joins two subtrees where every key of left is less than every key of right
+// by lifting the maximum of left into the root. The result has no parent.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::join_nodes(Node *left, Node *right) {
+    if (!left || !right) {
+        Node *res = left ? left : right;
+        if (res) res->prev = nullptr;
+        return res;
+    }
+
+    Node *max = left;
+    while (max->right) max = max->right;
+    if (max != left) {
+        max->prev->right = max->left;
+        if (max->left) max->left->prev = max->prev;
+        max->left = left;
+        left->prev = max;
+    }
+    max->right = right;
+    right->prev = max;
+    max->prev = nullptr;
+    return max;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::union_nodes(Node *&link, Node *prev, Node *other, detached& garbage, unsigned depth, size_type work) {
+    if (!other) return;
+    Node *node = link;
+    if (!node) {
+        link = other;
+        other->prev = prev;
+        return;
+    }
+
+    Node *less, *greater;
+    detach(garbage, split_nodes(other, node->value, less, greater));
+    if (depth && (work >= 2 * bulk_grain_) && less && greater) {
+        detached left_garbage;
+        std::thread left([&] { union_nodes(node->left, node, less, left_garbage, depth - 1, work / 2); });
+        union_nodes(node->right, node, greater, garbage, depth - 1, work / 2);
+        left.join();
+        detach(garbage, left_garbage);
     } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        return pos.node_;
+        union_nodes(node->left, node, less, garbage, depth, work / 2);
+        union_nodes(node->right, node, greater, garbage, depth, work / 2);
     }
 }
 
 template<class T, class C, class A>
-template< class C2 >
-void bst_in<T,C,A>::merge(bst_in<T,C2,A>& source) {
-    while (source.size()) {
-        insert(source.extract(source.begin()));
+void bst_in<T,C,A>::intersect_nodes(Node *&link, Node *prev, Node *other, detached& garbage, unsigned depth, size_type work) {
+    Node *node = link;
+    if (!node || !other) {
+        detach(garbage, node);
+        detach(garbage, other);
+        link = nullptr;
+        return;
     }
+
+    Node *less, *greater;
+    Node *equal = split_nodes(other, node->value, less, greater);
+    if (depth && (work >= 2 * bulk_grain_) && less && greater) {
+        detached left_garbage;
+        std::thread left([&] { intersect_nodes(node->left, node, less, left_garbage, depth - 1, work / 2); });
+        intersect_nodes(node->right, node, greater, garbage, depth - 1, work / 2);
+        left.join();
+        detach(garbage, left_garbage);
+    } else {
+        intersect_nodes(node->left, node, less, garbage, depth, work / 2);
+        intersect_nodes(node->right, node, greater, garbage, depth, work / 2);
+    }
+
+    if (equal) {
+        detach(garbage, equal);
+        return;
+    }
+    link = join_nodes(node->left, node->right);
+    if (link) link->prev = prev;
+    node->left = node->right = nullptr;
+    detach(garbage, node);
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::difference_nodes(Node *&link, Node *prev, Node *other, detached& garbage, unsigned depth, size_type work) {
+    Node *node = link;
+    if (!node || !other) {
+        detach(garbage, other);
+        return;
+    }
+
+    Node *less, *greater;
+    Node *equal = split_nodes(other, node->value, less, greater);
+    if (depth && (work >= 2 * bulk_grain_) && less && greater) {
+        detached left_garbage;
+        std::thread left([&] { difference_nodes(node->left, node, less, left_garbage, depth - 1, work / 2); });
+        difference_nodes(node->right, node, greater, garbage, depth - 1, work / 2);
+        left.join();
+        detach(garbage, left_garbage);
+    } else {
+        difference_nodes(node->left, node, less, garbage, depth, work / 2);
+        difference_nodes(node->right, node, greater, garbage, depth, work / 2);
+    }
+
+    if (!equal) return;
+    detach(garbage, equal);
+    link = join_nodes(node->left, node->right);
+    if (link) link->prev = prev;
+    node->left = node->right = nullptr;
+    detach(garbage, node);
 }
 
 template<class T, class C, class A>
@@ -710,7 +1328,6 @@ typename bst_in<T,C,A>::const_iterator bst_in<T,C,A>::find(const T& key) const {
         else pos.node_ = pos.node_->right;
     }
 
-    if (!pos.node_) return cend();
     return pos;
 }
 
@@ -792,11 +1409,338 @@ std::pair<typename bst_in<T,C,A>::const_iterator,typename bst_in<T,C,A>::const_i
     return {lower_bound(key), upper_bound(key)};
 }
 
+template <class T, class C, class A>
+std::ranges::subrange<typename bst_in<T,C,A>::iterator> bst_in<T,C,A>::subrange(const T& lo, const T& hi) {
+    if (!(lo < hi)) return {end(), end()};
+    return {lower_bound(lo), lower_bound(hi)};
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::chunk* bst_in<T,C,A>::find_chunk(const Node *node) const {
+    std::less<const Node*> less;
+    size_t lo = 0, hi = chunk_count_;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (less(node, chunks_[mid].nodes)) hi = mid;
+        else lo = mid + 1;
+    }
+    if (!lo || !less(node, chunks_[lo - 1].nodes + chunks_[lo - 1].size)) return nullptr;
+    return chunks_ + lo - 1;
+}
+
+// Allocates an empty block of n nodes and enters it into the chunk table.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::add_chunk(size_t n) {
+    using ChunkAlloc = typename AllocTraits::template rebind_alloc<chunk>;
+    using ChunkAllocTraits = std::allocator_traits<ChunkAlloc>;
+    ChunkAlloc chunk_alloc(alloc_);
+    if (chunk_count_ == chunk_capacity_) {
+        size_t capacity = chunk_capacity_ ? 2 * chunk_capacity_ : 4;
+        chunk *table = ChunkAllocTraits::allocate(chunk_alloc, capacity);
+        if (chunk_count_) std::copy(chunks_, chunks_ + chunk_count_, table);
+        if (chunks_) ChunkAllocTraits::deallocate(chunk_alloc, chunks_, chunk_capacity_);
+        chunks_ = table;
+        chunk_capacity_ = capacity;
+    }
+
+    Node *nodes = NodeAllocTraits::allocate(alloc_, n);
+    std::less<const Node*> less;
+    size_t pos = chunk_count_;
+    while (pos && less(nodes, chunks_[pos - 1].nodes)) {
+        chunks_[pos] = chunks_[pos - 1];
+        --pos;
+    }
+    chunks_[pos] = {nodes, n, 0, 0};
+    ++chunk_count_;
+    return nodes;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::free_node(Node *node) {
+    NodeAllocTraits::destroy(alloc_, node);
+    chunk *block = find_chunk(node);
+    if (!block) {
+        NodeAllocTraits::deallocate(alloc_, node, 1);
+    } else if (!--block->live) {
+        if (block->nodes == fill_) fill_ = nullptr;
+        NodeAllocTraits::deallocate(alloc_, block->nodes, block->size);
+        std::copy(block + 1, chunks_ + chunk_count_, block);
+        if (!--chunk_count_) {
+            using ChunkAlloc = typename AllocTraits::template rebind_alloc<chunk>;
+            ChunkAlloc chunk_alloc(alloc_);
+            std::allocator_traits<ChunkAlloc>::deallocate(chunk_alloc, chunks_, chunk_capacity_);
+            chunks_ = nullptr;
+            chunk_capacity_ = 0;
+        }
+    }
+}
+
+// Node handles leave the tree as separate allocations, so a node that sits
+// in the relayout block is copied out first.
+template<class T, class C, class A>
+typename bst_in<T,C,A>::Node* bst_in<T,C,A>::unblock(Node *node) {
+    if (!find_chunk(node)) return node;
+    Node *res = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, res, node->value);
+    free_node(node);
+    return res;
+}
+
+// Lays out the top height levels of the subtree at node in van Emde Boas
+// order: the top half of the levels recursively, then every subtree hanging
+// below them recursively. Nodes are appended to order; the roots of the
+// subtrees left below the laid out levels are pushed onto frontier.
+template<class T, class C, class A>
+void bst_in<T,C,A>::veb_place(Node *node, size_t height, Node **order, size_t& placed, Node **frontier, size_t& top) {
+    if (height == 1) {
+        order[placed++] = node;
+        if (node->left) frontier[top++] = node->left;
+        if (node->right) frontier[top++] = node->right;
+        return;
+    }
+
+    size_t upper = height / 2, base = top;
+    veb_place(node, upper, order, placed, frontier, top);
+    size_t roots = top;
+    for (size_t i = base; i < roots; ++i) veb_place(frontier[i], height - upper, order, placed, frontier, top);
+    std::move(frontier + roots, frontier + top, frontier + base);
+    top = base + (top - roots);
+}
+
+// Moves the n nodes listed in order to dest[0, n), or to separate
+// allocations when dest is null. Each old node's prev is used to forward to
+// its copy while the links are rewritten.
+template<class T, class C, class A>
+void bst_in<T,C,A>::relocate(Node **order, size_t n, Node *dest) {
+    for (size_t i = 0; i < n; ++i) {
+        Node *from = order[i];
+        Node *to = dest ? dest + i : NodeAllocTraits::allocate(alloc_, 1);
+        NodeAllocTraits::construct(alloc_, to, std::move(from->value));
+        to->left = from->left;
+        to->right = from->right;
+        to->prev = from->prev;
+        to->prev.set_tag(from->prev.tag());
+        from->prev = to;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        Node *to = order[i]->prev;
+        if (to->left) to->left = to->left->prev;
+        if (to->right) to->right = to->right->prev;
+        if (to->prev) to->prev = to->prev->prev;
+    }
+    root_ = root_->prev;
+    for (size_t i = 0; i < n; ++i) free_node(order[i]);
+}
+
+// Reallocates all nodes into one contiguous block in van Emde Boas order, so
+// that a root-to-leaf walk touches O(log_B n) blocks for every block size B.
+// Iterators and node references are invalidated.
+template<class T, class C, class A>
+void bst_in<T,C,A>::relayout() {
+    reclaim_pending(std::numeric_limits<size_type>::max());
+    size_t n = size();
+    if (!n) return;
+
+    size_t height = 0, depth = 1;
+    Node *node = root_;
+    while (node->left) {
+        node = node->left;
+        ++depth;
+    }
+    while (node) {
+        height = std::max(height, depth);
+        if (node->right) {
+            node = node->right;
+            ++depth;
+            while (node->left) {
+                node = node->left;
+                ++depth;
+            }
+        } else {
+            while (node->prev && (node->prev->right == node)) {
+                node = node->prev;
+                --depth;
+            }
+            node = node->prev;
+            --depth;
+        }
+    }
+
+    using PtrAlloc = typename AllocTraits::template rebind_alloc<Node*>;
+    PtrAlloc ptr_alloc(alloc_);
+    Node **order = std::allocator_traits<PtrAlloc>::allocate(ptr_alloc, 2 * n);
+    size_t placed = 0, top = 0;
+    veb_place(root_, height, order, placed, order + n, top);
+
+    Node *block = add_chunk(n);
+    chunk *entry = find_chunk(block);
+    entry->used = n;
+    entry->live = n;
+    relocate(order, n, block);
+    std::allocator_traits<PtrAlloc>::deallocate(ptr_alloc, order, 2 * n);
+}
+
+// Moves the tree back to one allocation per node, before nodes are handed
+// to another tree that would free them individually.
+template<class T, class C, class A>
+void bst_in<T,C,A>::release_layout() {
+    if (!chunk_count_) return;
+    reclaim_pending(std::numeric_limits<size_type>::max());
+    if (!chunk_count_) return;
+    size_t n = size();
+
+    using PtrAlloc = typename AllocTraits::template rebind_alloc<Node*>;
+    PtrAlloc ptr_alloc(alloc_);
+    Node **order = std::allocator_traits<PtrAlloc>::allocate(ptr_alloc, n);
+    size_t i = 0;
+    for (iterator it = begin(); it != end(); ++it) order[i++] = it.node_;
+    relocate(order, n, nullptr);
+    std::allocator_traits<PtrAlloc>::deallocate(ptr_alloc, order, n);
+}
+
+// Moves node into the slot to and points its parent and children at it.
+template<class T, class C, class A>
+void bst_in<T,C,A>::move_node(Node *node, Node *to) {
+    NodeAllocTraits::construct(alloc_, to, std::move(node->value));
+    to->left = node->left;
+    to->right = node->right;
+    to->prev = node->prev;
+    to->prev.set_tag(node->prev.tag());
+    if (to->left) to->left->prev = to;
+    if (to->right) to->right->prev = to;
+    if (!to->prev) root_ = to;
+    else if (to->prev->left == node) to->prev->left = to;
+    else to->prev->right = to;
+    free_node(node);
+}
+
+// Incremental defragmentation: visits at most budget nodes in order and moves
+// every node that is allocated on its own, or sits in a block less than half
+// live, into the block being filled, so that neighbours in key order end up
+// next to each other. A new block holds at most chunk_bytes_, and no more
+// nodes than are not yet in a dense block, so small trees get small blocks.
+// A sparse block is freed with its last node; a block being filled that went
+// sparse is given up at the start of the next pass. Nodes moved out of their
+// own allocations stay resident in the heap's free lists, so a completed pass
+// ends with bst_trim_heap, at the cost of about one heap walk per pass. The
+// next call resumes after the last visited key, so the tree may change
+// between calls. Returns true when a pass over the whole tree is complete.
+// Iterators to moved nodes are invalidated.
+template<class T, class C, class A>
+bool bst_in<T,C,A>::compact(size_type budget) {
+    const size_t chunk_nodes = std::max<size_t>(1, chunk_bytes_ / sizeof(Node));
+    Node *node = compact_from_ ? upper_bound(*compact_from_).node_ : begin().node_;
+    if (!compact_from_ && fill_) {
+        chunk *fill = find_chunk(fill_);
+        if (2 * fill->live < fill->used) fill_ = nullptr;
+    }
+
+    Node *last = nullptr;
+    for (; node && budget; --budget) {
+        Node *next = node->right;
+        if (next) {
+            while (next->left) next = next->left;
+        } else {
+            next = node;
+            while (next->prev && (next->prev->right == next)) next = next->prev;
+            next = next->prev;
+        }
+
+        last = node;
+        chunk *block = find_chunk(node);
+        if (!block || ((block->nodes != fill_) && (2 * block->live < block->used))) {
+            chunk *fill = fill_ ? find_chunk(fill_) : nullptr;
+            if (!fill || (fill->used == fill->size)) {
+                size_t dense = 0;
+                for (size_t i = 0; i < chunk_count_; ++i) {
+                    if (2 * chunks_[i].live >= chunks_[i].used) dense += chunks_[i].live;
+                }
+                fill_ = add_chunk(std::min(chunk_nodes, std::max<size_t>(1, size() - dense)));
+                fill = find_chunk(fill_);
+            }
+            last = fill->nodes + fill->used++;
+            ++fill->live;
+            move_node(node, last);
+        }
+        node = next;
+    }
+
+    if (node) {
+        if (last) compact_from_ = last->value;
+        return false;
+    }
+    compact_from_.reset();
+    bst_trim_heap(alloc_);
+    return true;
+}
+
+template<class T, class C, class A>
+void bst_in<T,C,A>::prefetch(const Node *node) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(node);
+#endif
+}
+
+template<class T, class C, class A>
+typename bst_in<T,C,A>::size_type bst_in<T,C,A>::copy_to(std::span<T> out, const_iterator& pos) const {
+    size_type n = 0;
+    while (pos.node_ && (n < out.size())) {
+        prefetch(pos.node_->left);
+        prefetch(pos.node_->right);
+        prefetch(pos.node_->prev);
+        out[n++] = pos.node_->value;
+        ++pos;
+    }
+    return n;
+}
+
+template<class T, class C, class A>
+template< class F >
+void bst_in<T,C,A>::for_each_chunk(size_type chunk_size, F f) const {
+    if (!root_ || !chunk_size) return;
+    A alloc(alloc_);
+    T *buffer = AllocTraits::allocate(alloc, chunk_size);
+
+    const_iterator pos; pos.root_ = root_;
+    Node *node = root_;
+    while (node && node->left) node = node->left;
+    pos.node_ = node;
+
+    while (pos.node_) {
+        size_type n = 0;
+        while (pos.node_ && (n < chunk_size)) {
+            prefetch(pos.node_->left);
+            prefetch(pos.node_->right);
+            prefetch(pos.node_->prev);
+            AllocTraits::construct(alloc, buffer + n, pos.node_->value);
+            ++n;
+            ++pos;
+        }
+        f(std::span<const T>(buffer, n));
+        for (size_type i = 0; i < n; ++i) AllocTraits::destroy(alloc, buffer + i);
+    }
+    AllocTraits::deallocate(alloc, buffer, chunk_size);
+}
+
 template <class T, class C, class A>
 void swap(bst_in<T,C,A>& lhs, bst_in<T,C,A>& rhs) {
     if (lhs != rhs) {
         std::swap(lhs.alloc_, rhs.alloc_);
         std::swap(lhs.root_, rhs.root_);
         std::swap(lhs.size_, rhs.size_);
+        std::swap(lhs.reclaim_, rhs.reclaim_);
+        std::swap(lhs.reclaim_list_, rhs.reclaim_list_);
+        std::swap(lhs.reclaim_count_, rhs.reclaim_count_);
+        std::swap(lhs.chunks_, rhs.chunks_);
+        std::swap(lhs.chunk_count_, rhs.chunk_count_);
+        std::swap(lhs.chunk_capacity_, rhs.chunk_capacity_);
+        std::swap(lhs.fill_, rhs.fill_);
+        std::swap(lhs.compact_from_, rhs.compact_from_);
     }
-}
\ No newline at end of file
+}
+
+
+namespace bst_pmr {
+    template <class T, class C = std::less<T>>
+    using bst_in = ::bst_in<T, C, std::pmr::polymorphic_allocator<T>>;
+}
@@ -0,0 +1,530 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+// bst_in with nodes stored in one growable arena and linked by 32-bit slot
+// indices instead of pointers, so a node costs sizeof(T) + 12 bytes plus
+// padding. Slot 0 is the null index; erased slots go on a free list threaded
+// through their left index and are reused before the arena grows. Growing
+// relocates values, so iterators hold the container and an index rather than
+// a node address and stay valid across inserts.
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+class bst_in_arena {
+public:
+    typedef uint32_t index_type;
+
+private:
+    struct Node {
+        // The value's lifetime is managed by the arena; links are always live.
+        union {
+            T value;
+        };
+        index_type left, right, prev;
+        Node();
+        ~Node();
+    };
+
+    static constexpr index_type free_ = std::numeric_limits<index_type>::max();
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename A::size_type size_type;
+    typedef typename A::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef  A allocator_type;
+    typedef const T& reference;
+    typedef const T& const_reference;
+    using AllocTraits = std::allocator_traits<A>;
+    using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+    using NodeAllocTraits = typename AllocTraits::template rebind_traits<Node>;
+
+    class iterator {
+    public:
+        const bst_in_arena *owner_;
+        index_type node_;
+        typedef typename A::difference_type difference_type;
+        typedef  T value_type;
+        typedef const T& reference;
+        typedef const T* pointer;
+        typedef std::bidirectional_iterator_tag iterator_category;
+
+        iterator();
+        iterator(const bst_in_arena *, index_type);
+
+        bool operator==(const iterator&) const;
+        bool operator!=(const iterator&) const;
+
+        iterator& operator++();
+        iterator& operator--();
+        iterator operator++(int);
+        iterator operator--(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+    };
+
+    typedef iterator const_iterator;
+    typedef typename std::reverse_iterator<iterator> reverse_iterator;
+    typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    bst_in_arena();
+    bst_in_arena(const bst_in_arena&);
+    bst_in_arena& operator=(const bst_in_arena&);
+    ~bst_in_arena();
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    const_reverse_iterator crbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crend() const;
+
+    void swap(bst_in_arena&);
+    size_type max_size() const;
+    bool empty() const;
+    allocator_type get_allocator() const;
+    size_t size() const;
+    size_t capacity() const;
+    void reserve(size_t);
+    void clear();
+    std::pair<iterator, bool> insert(const value_type&);
+    iterator erase(iterator);
+    size_type erase(const T&);
+    template< class C2 >
+    void merge(bst_in_arena<T, C2, A>&);
+
+    size_type count(const T&) const;
+    iterator find(const T&) const;
+    bool contains(const T&) const;
+    iterator lower_bound(const T&) const;
+    iterator upper_bound(const T&) const;
+    std::pair<iterator, iterator> equal_range(const T&) const;
+
+private:
+    Node *nodes_;
+    index_type capacity_, used_, root_, free_list_;
+    size_t size_;
+    NodeAlloc alloc_;
+
+    Node& at(index_type) const;
+    index_type make_node(const T&);
+    void free_node(index_type);
+    void grow(size_t);
+    void transplant(index_type, index_type);
+    index_type min_of(index_type) const;
+    index_type max_of(index_type) const;
+    index_type next_of(index_type) const;
+    index_type prev_of(index_type) const;
+};
+
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+void swap(bst_in_arena<T,C,A>&, bst_in_arena<T,C,A>&);
+
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::Node::Node(): left(0), right(0), prev(free_) {}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::Node::~Node() {}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::iterator::iterator(): owner_(nullptr), node_(0) {}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::iterator::iterator(const bst_in_arena *owner, index_type node): owner_(owner), node_(node) {}
+
+template<class T, class C, class A>
+bool bst_in_arena<T,C,A>::iterator::operator==(const iterator& other) const {
+    return node_ == other.node_;
+}
+
+template<class T, class C, class A>
+bool bst_in_arena<T,C,A>::iterator::operator!=(const iterator& other) const {
+    return node_ != other.node_;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator& bst_in_arena<T,C,A>::iterator::operator++() {
+    if (node_) node_ = owner_->next_of(node_);
+    return *this;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator& bst_in_arena<T,C,A>::iterator::operator--() {
+    if (!node_) node_ = owner_->max_of(owner_->root_);
+    else node_ = owner_->prev_of(node_);
+    return *this;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::iterator::operator++(int) {
+    iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::iterator::operator--(int) {
+    iterator res(*this);
+    --(*this);
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator::reference bst_in_arena<T,C,A>::iterator::operator*() const {
+    return owner_->at(node_).value;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator::pointer bst_in_arena<T,C,A>::iterator::operator->() const {
+    return &(owner_->at(node_).value);
+}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::bst_in_arena(): nodes_(nullptr), capacity_(0), used_(0), root_(0), free_list_(0), size_(0), alloc_() {}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::bst_in_arena(const bst_in_arena& other): bst_in_arena() {
+    alloc_ = other.alloc_;
+    if (!other.used_) return;
+    grow(other.used_ + 1);
+    A alloc(alloc_);
+    for (index_type i = 1; i <= other.used_; ++i) {
+        const Node& from = other.at(i);
+        Node& to = at(i);
+        to.left = from.left;
+        to.right = from.right;
+        to.prev = from.prev;
+        if (from.prev != free_) AllocTraits::construct(alloc, &to.value, from.value);
+    }
+    used_ = other.used_;
+    root_ = other.root_;
+    free_list_ = other.free_list_;
+    size_ = other.size_;
+}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>& bst_in_arena<T,C,A>::operator=(const bst_in_arena& other) {
+    if (this == &other) return *this;
+    bst_in_arena copy(other);
+    swap(copy);
+    return *this;
+}
+
+template<class T, class C, class A>
+bst_in_arena<T,C,A>::~bst_in_arena() {
+    clear();
+    for (index_type i = 0; i < capacity_; ++i) NodeAllocTraits::destroy(alloc_, nodes_ + i);
+    if (nodes_) NodeAllocTraits::deallocate(alloc_, nodes_, capacity_);
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::Node& bst_in_arena<T,C,A>::at(index_type i) const {
+    return nodes_[i];
+}
+
+// Reallocates the arena to hold at least n slots (slot 0 included), moving
+// live values; links are indices and need no fixing.
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::grow(size_t n) {
+    if (n <= capacity_) return;
+    if (n > free_) throw std::length_error("bst_in_arena: more than 2^32 - 2 nodes");
+    size_t capacity = std::max<size_t>(capacity_ ? 2 * size_t(capacity_) : 16, n);
+    capacity = std::min<size_t>(capacity, free_);
+
+    Node *nodes = NodeAllocTraits::allocate(alloc_, capacity);
+    A alloc(alloc_);
+    for (size_t i = 0; i < capacity; ++i) NodeAllocTraits::construct(alloc_, nodes + i);
+    for (index_type i = 1; i <= used_; ++i) {
+        nodes[i].left = nodes_[i].left;
+        nodes[i].right = nodes_[i].right;
+        nodes[i].prev = nodes_[i].prev;
+        if (nodes_[i].prev != free_) {
+            AllocTraits::construct(alloc, &nodes[i].value, std::move(nodes_[i].value));
+            AllocTraits::destroy(alloc, &nodes_[i].value);
+        }
+    }
+    for (index_type i = 0; i < capacity_; ++i) NodeAllocTraits::destroy(alloc_, nodes_ + i);
+    if (nodes_) NodeAllocTraits::deallocate(alloc_, nodes_, capacity_);
+    nodes_ = nodes;
+    capacity_ = capacity;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::index_type bst_in_arena<T,C,A>::make_node(const T& value) {
+    index_type i = free_list_;
+    if (i) {
+        free_list_ = at(i).left;
+    } else {
+        grow(size_t(used_) + 2);
+        i = ++used_;
+    }
+    A alloc(alloc_);
+    AllocTraits::construct(alloc, &at(i).value, value);
+    at(i).left = at(i).right = at(i).prev = 0;
+    return i;
+}
+
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::free_node(index_type i) {
+    A alloc(alloc_);
+    AllocTraits::destroy(alloc, &at(i).value);
+    at(i).prev = free_;
+    at(i).right = 0;
+    at(i).left = free_list_;
+    free_list_ = i;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::index_type bst_in_arena<T,C,A>::min_of(index_type i) const {
+    while (i && at(i).left) i = at(i).left;
+    return i;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::index_type bst_in_arena<T,C,A>::max_of(index_type i) const {
+    while (i && at(i).right) i = at(i).right;
+    return i;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::index_type bst_in_arena<T,C,A>::next_of(index_type i) const {
+    if (at(i).right) return min_of(at(i).right);
+    while (at(i).prev && (at(at(i).prev).left != i)) i = at(i).prev;
+    return at(i).prev;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::index_type bst_in_arena<T,C,A>::prev_of(index_type i) const {
+    if (at(i).left) return max_of(at(i).left);
+    while (at(i).prev && (at(at(i).prev).right != i)) i = at(i).prev;
+    return at(i).prev;
+}
+
+// Puts the subtree v where the subtree u hangs.
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::transplant(index_type u, index_type v) {
+    index_type parent = at(u).prev;
+    if (!parent) root_ = v;
+    else if (at(parent).left == u) at(parent).left = v;
+    else at(parent).right = v;
+    if (v) at(v).prev = parent;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::begin() const {
+    return iterator(this, min_of(root_));
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::end() const {
+    return iterator(this, 0);
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::const_iterator bst_in_arena<T,C,A>::cbegin() const {
+    return begin();
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::const_iterator bst_in_arena<T,C,A>::cend() const {
+    return end();
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::reverse_iterator bst_in_arena<T,C,A>::rbegin() const {
+    return reverse_iterator(end());
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::const_reverse_iterator bst_in_arena<T,C,A>::crbegin() const {
+    return const_reverse_iterator(end());
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::reverse_iterator bst_in_arena<T,C,A>::rend() const {
+    return reverse_iterator(begin());
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::const_reverse_iterator bst_in_arena<T,C,A>::crend() const {
+    return const_reverse_iterator(begin());
+}
+
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::swap(bst_in_arena& other) {
+    if (this == &other) return;
+    std::swap(nodes_, other.nodes_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(used_, other.used_);
+    std::swap(root_, other.root_);
+    std::swap(free_list_, other.free_list_);
+    std::swap(size_, other.size_);
+    std::swap(alloc_, other.alloc_);
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::size_type bst_in_arena<T,C,A>::max_size() const {
+    return free_ - 2;
+}
+
+template<class T, class C, class A>
+bool bst_in_arena<T,C,A>::empty() const {return size_ == 0;}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::allocator_type bst_in_arena<T,C,A>::get_allocator() const {
+    return alloc_;
+}
+
+template<class T, class C, class A>
+size_t bst_in_arena<T,C,A>::size() const {return size_;}
+
+template<class T, class C, class A>
+size_t bst_in_arena<T,C,A>::capacity() const {
+    return capacity_ ? capacity_ - 1 : 0;
+}
+
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::reserve(size_t n) {
+    grow(n + 1);
+}
+
+// Destroys every value but keeps the arena for reuse.
+template<class T, class C, class A>
+void bst_in_arena<T,C,A>::clear() {
+    A alloc(alloc_);
+    for (index_type i = 1; i <= used_; ++i) {
+        if (at(i).prev != free_) AllocTraits::destroy(alloc, &at(i).value);
+        at(i).left = at(i).right = 0;
+        at(i).prev = free_;
+    }
+    used_ = root_ = free_list_ = 0;
+    size_ = 0;
+}
+
+template<class T, class C, class A>
+std::pair<typename bst_in_arena<T,C,A>::iterator, bool> bst_in_arena<T,C,A>::insert(const value_type& value) {
+    index_type node = root_, prev = 0;
+    while (node && (at(node).value != value)) {
+        prev = node;
+        if (at(node).value > value) node = at(node).left;
+        else node = at(node).right;
+    }
+    if (node) return {iterator(this, node), false};
+
+    node = make_node(value);
+    at(node).prev = prev;
+    if (!prev) root_ = node;
+    else if (at(prev).value < value) at(prev).right = node;
+    else at(prev).left = node;
+    size_++;
+    return {iterator(this, node), true};
+}
+
+// Relinks the successor into the erased node's place, so iterators to other
+// elements stay valid.
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::erase(iterator pos) {
+    index_type node = pos.node_;
+    if (!node) return pos;
+    index_type next = next_of(node);
+
+    if (!at(node).left) {
+        transplant(node, at(node).right);
+    } else if (!at(node).right) {
+        transplant(node, at(node).left);
+    } else {
+        if (at(next).prev != node) {
+            transplant(next, at(next).right);
+            at(next).right = at(node).right;
+            at(at(next).right).prev = next;
+        }
+        transplant(node, next);
+        at(next).left = at(node).left;
+        at(at(next).left).prev = next;
+    }
+    free_node(node);
+    size_--;
+    return iterator(this, next);
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::size_type bst_in_arena<T,C,A>::erase(const T& key) {
+    iterator pos = find(key);
+    if (!pos.node_) return 0;
+    erase(pos);
+    return 1;
+}
+
+template<class T, class C, class A>
+template< class C2 >
+void bst_in_arena<T,C,A>::merge(bst_in_arena<T,C2,A>& source) {
+    for (auto it = source.begin(); it != source.end(); ++it) insert(*it);
+    source.clear();
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::size_type bst_in_arena<T,C,A>::count(const T& key) const {
+    return find(key).node_ ? 1 : 0;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::find(const T& key) const {
+    index_type node = root_;
+    while (node && (at(node).value != key)) {
+        if (at(node).value > key) node = at(node).left;
+        else node = at(node).right;
+    }
+    return iterator(this, node);
+}
+
+template<class T, class C, class A>
+bool bst_in_arena<T,C,A>::contains(const T& key) const {
+    return find(key).node_ != 0;
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::lower_bound(const T& key) const {
+    index_type node = root_, res = 0;
+    while (node) {
+        if (at(node).value < key) {
+            node = at(node).right;
+        } else {
+            res = node;
+            node = at(node).left;
+        }
+    }
+    return iterator(this, res);
+}
+
+template<class T, class C, class A>
+typename bst_in_arena<T,C,A>::iterator bst_in_arena<T,C,A>::upper_bound(const T& key) const {
+    index_type node = root_, res = 0;
+    while (node) {
+        if (at(node).value > key) {
+            res = node;
+            node = at(node).left;
+        } else {
+            node = at(node).right;
+        }
+    }
+    return iterator(this, res);
+}
+
+template<class T, class C, class A>
+std::pair<typename bst_in_arena<T,C,A>::iterator, typename bst_in_arena<T,C,A>::iterator> bst_in_arena<T,C,A>::equal_range(const T& key) const {
+    return {lower_bound(key), upper_bound(key)};
+}
+
+template <class T, class C, class A>
+void swap(bst_in_arena<T,C,A>& lhs, bst_in_arena<T,C,A>& rhs) {
+    lhs.swap(rhs);
+}
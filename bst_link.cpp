@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Node link with Bits small flags packed into the low alignment bits of the
+// pointer, so per-node metadata (colour, balance, thread or pending bits)
+// costs no extra word. The link converts to and from N* and dereferences like
+// one; iterators keep holding plain N*.
+//
+// The flags belong to the node that owns the link, not to the pointer value:
+// assigning a pointer or another link replaces only the pointer and keeps the
+// flags, so relinking a node never loses its metadata. Copy construction
+// copies both, which keeps std::swap of two links flag-preserving as well.
+template <class N, unsigned Bits = 2>
+class bst_link {
+public:
+    static constexpr uintptr_t tag_mask = (uintptr_t(1) << Bits) - 1;
+
+    bst_link() noexcept;
+    bst_link(N *) noexcept;
+    bst_link(const bst_link&) noexcept;
+    bst_link& operator=(const bst_link&) noexcept;
+    bst_link& operator=(N *) noexcept;
+
+    N* get() const noexcept;
+    operator N*() const noexcept;
+    N* operator->() const noexcept;
+    N& operator*() const noexcept;
+
+    unsigned tag() const noexcept;
+    void set_tag(unsigned) noexcept;
+    bool test(unsigned) const noexcept;
+    void set(unsigned, bool) noexcept;
+
+private:
+    uintptr_t bits_;
+};
+
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>::bst_link() noexcept: bits_(0) {}
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>::bst_link(N *ptr) noexcept: bits_(reinterpret_cast<uintptr_t>(ptr)) {}
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>::bst_link(const bst_link& other) noexcept: bits_(other.bits_) {}
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>& bst_link<N, Bits>::operator=(const bst_link& other) noexcept {
+    return *this = other.get();
+}
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>& bst_link<N, Bits>::operator=(N *ptr) noexcept {
+    bits_ = reinterpret_cast<uintptr_t>(ptr) | (bits_ & tag_mask);
+    return *this;
+}
+
+template <class N, unsigned Bits>
+inline N* bst_link<N, Bits>::get() const noexcept {
+    return reinterpret_cast<N*>(bits_ & ~tag_mask);
+}
+
+template <class N, unsigned Bits>
+inline bst_link<N, Bits>::operator N*() const noexcept {
+    return get();
+}
+
+template <class N, unsigned Bits>
+inline N* bst_link<N, Bits>::operator->() const noexcept {
+    return get();
+}
+
+template <class N, unsigned Bits>
+inline N& bst_link<N, Bits>::operator*() const noexcept {
+    return *get();
+}
+
+// N is complete by the time a flag is touched, so the alignment check lives
+// here rather than in the class body.
+template <class N, unsigned Bits>
+inline unsigned bst_link<N, Bits>::tag() const noexcept {
+    static_assert(alignof(N) > tag_mask, "node alignment leaves too few free pointer bits");
+    return bits_ & tag_mask;
+}
+
+template <class N, unsigned Bits>
+inline void bst_link<N, Bits>::set_tag(unsigned tag) noexcept {
+    static_assert(alignof(N) > tag_mask, "node alignment leaves too few free pointer bits");
+    bits_ = (bits_ & ~tag_mask) | (tag & tag_mask);
+}
+
+template <class N, unsigned Bits>
+inline bool bst_link<N, Bits>::test(unsigned bit) const noexcept {
+    return tag() & (1u << bit);
+}
+
+template <class N, unsigned Bits>
+inline void bst_link<N, Bits>::set(unsigned bit, bool on) noexcept {
+    set_tag(on ? (tag() | (1u << bit)) : (tag() & ~(1u << bit)));
+}
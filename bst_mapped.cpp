@@ -0,0 +1,476 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only in-order view over a tree image that is mmap'ed straight from a
+// file. Links are byte offsets from the start of the mapping (0 means null),
+// so the image is position independent and pages are faulted in on demand.
+// open() checks only the header; links are checked as they are followed and
+// a corrupt one throws std::runtime_error. verify() checks the whole image.
+template <class T, class C = std::less<T>>
+class bst_mapped {
+private:
+    struct Node {
+        T value;
+        uint64_t left, right, prev;
+    };
+
+    struct Header {
+        uint64_t magic;
+        uint64_t value_size;
+        uint64_t count;
+        uint64_t root;
+    };
+
+    static constexpr uint64_t magic_ = 0x31504d4d545342ull;
+    static constexpr uint64_t nodes_offset_ = (sizeof(Header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    static constexpr size_t buffer_bytes_ = 1 << 16;
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef const T& reference;
+    typedef const T& const_reference;
+
+    class const_iterator {
+    public:
+        const unsigned char *base_;
+        uint64_t limit_;
+        const Node *node_;
+        typedef ptrdiff_t difference_type;
+        typedef  T value_type;
+        typedef const T& reference;
+        typedef const T* pointer;
+        typedef std::bidirectional_iterator_tag iterator_category;
+
+        const_iterator();
+        const_iterator(const unsigned char *, uint64_t, const Node *);
+
+        bool operator==(const const_iterator&) const;
+        bool operator!=(const const_iterator&) const;
+
+        const_iterator& operator++();
+        const_iterator& operator--();
+        const_iterator operator++(int);
+        const_iterator operator--(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+    private:
+        const Node *at(uint64_t) const;
+        const Node *child(uint64_t) const;
+        uint64_t offset() const;
+    };
+
+    typedef const_iterator iterator;
+    typedef typename std::reverse_iterator<const_iterator> reverse_iterator;
+    typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    bst_mapped();
+    bst_mapped(const bst_mapped&) = delete;
+    bst_mapped& operator=(const bst_mapped&) = delete;
+    ~bst_mapped();
+
+    template< class It >
+    static bool write(int, It, size_type);
+    bool open(const char *);
+    void close();
+    bool verify() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    bool empty() const;
+    size_type size() const;
+
+    size_type count(const T&) const;
+    const_iterator find(const T&) const;
+    bool contains(const T&) const;
+    const_iterator lower_bound(const T&) const;
+    const_iterator upper_bound(const T&) const;
+    std::pair<const_iterator, const_iterator> equal_range(const T&) const;
+
+private:
+    const unsigned char *base_;
+    size_t length_;
+    uint64_t limit_;
+    const Node *root_;
+    size_t size_;
+    C comp_;
+
+    const Node *child(const Node *, uint64_t) const;
+    static const Node *node_at(const unsigned char *, uint64_t, uint64_t);
+    static const Node *child_at(const unsigned char *, uint64_t, const Node *, uint64_t);
+    static bool write_all(int, const unsigned char *, size_t);
+    template< class It >
+    static bool write_nodes(int, It&, uint64_t, uint64_t, uint64_t, unsigned char *, size_t&);
+    static uint64_t offset_of(uint64_t, uint64_t);
+    static bool valid_link(uint64_t, uint64_t);
+};
+
+
+template<class T, class C>
+bst_mapped<T, C>::const_iterator::const_iterator(): base_(nullptr), limit_(0), node_(nullptr) {}
+
+template<class T, class C>
+bst_mapped<T, C>::const_iterator::const_iterator(const unsigned char *base, uint64_t limit, const Node *node):
+    base_(base), limit_(limit), node_(node) {}
+
+template<class T, class C>
+const typename bst_mapped<T, C>::Node* bst_mapped<T, C>::const_iterator::at(uint64_t offset) const {
+    return node_at(base_, limit_, offset);
+}
+
+template<class T, class C>
+const typename bst_mapped<T, C>::Node* bst_mapped<T, C>::const_iterator::child(uint64_t offset) const {
+    return child_at(base_, limit_, node_, offset);
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::const_iterator::operator==(const const_iterator& other) const {
+    return node_ == other.node_;
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::const_iterator::operator!=(const const_iterator& other) const {
+    return node_ != other.node_;
+}
+
+template<class T, class C>
+uint64_t bst_mapped<T, C>::const_iterator::offset() const {
+    return reinterpret_cast<const unsigned char*>(node_) - base_;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator& bst_mapped<T, C>::const_iterator::operator++() {
+    if (!node_) return *this;
+
+    if (node_->right) {
+        node_ = child(node_->right);
+        while (node_->left) node_ = child(node_->left);
+        return *this;
+    }
+
+    while (node_->prev && (at(node_->prev)->left != offset())) node_ = at(node_->prev);
+    node_ = at(node_->prev);
+    return *this;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator& bst_mapped<T, C>::const_iterator::operator--() {
+    if (!node_) {
+        node_ = at(reinterpret_cast<const Header*>(base_)->root);
+        while (node_->right) node_ = child(node_->right);
+        return *this;
+    }
+
+    if (node_->left) {
+        node_ = child(node_->left);
+        while (node_->right) node_ = child(node_->right);
+        return *this;
+    }
+
+    while (node_->prev && (at(node_->prev)->right != offset())) node_ = at(node_->prev);
+    node_ = at(node_->prev);
+    return *this;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::const_iterator::operator++(int) {
+    const_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::const_iterator::operator--(int) {
+    const_iterator res(*this);
+    --(*this);
+    return res;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator::reference bst_mapped<T, C>::const_iterator::operator*() const {
+    return node_->value;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator::pointer bst_mapped<T, C>::const_iterator::operator->() const {
+    return &(node_->value);
+}
+
+template<class T, class C>
+bst_mapped<T, C>::bst_mapped(): base_(nullptr), length_(0), limit_(0), root_(nullptr), size_(0), comp_() {}
+
+template<class T, class C>
+bst_mapped<T, C>::~bst_mapped() {
+    close();
+}
+
+// Links come straight from the file, so each one is checked as it is
+// followed: it must name a whole node slot inside the mapping.
+template<class T, class C>
+const typename bst_mapped<T, C>::Node* bst_mapped<T, C>::node_at(const unsigned char *base, uint64_t limit, uint64_t offset) {
+    if (!offset) return nullptr;
+    if (!valid_link(offset, limit)) throw std::runtime_error("bst_mapped: node link outside the image");
+    return reinterpret_cast<const Node*>(base + offset);
+}
+
+// A child must link back to its parent. Every node is reached by such checked
+// descents from the root, so descents cannot cycle and climbing prev links
+// retraces them.
+template<class T, class C>
+const typename bst_mapped<T, C>::Node* bst_mapped<T, C>::child_at(const unsigned char *base, uint64_t limit,
+                                                                   const Node *parent, uint64_t offset) {
+    const Node *node = node_at(base, limit, offset);
+    uint64_t from = reinterpret_cast<const unsigned char*>(parent) - base;
+    if (node && ((node->prev != from) || (parent->left == parent->right))) {
+        throw std::runtime_error("bst_mapped: child does not link back to its parent");
+    }
+    return node;
+}
+
+template<class T, class C>
+const typename bst_mapped<T, C>::Node* bst_mapped<T, C>::child(const Node *parent, uint64_t offset) const {
+    return child_at(base_, limit_, parent, offset);
+}
+
+template<class T, class C>
+uint64_t bst_mapped<T, C>::offset_of(uint64_t l, uint64_t r) {
+    if (l >= r) return 0;
+    return nodes_offset_ + (l + (r - l) / 2) * sizeof(Node);
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::write_all(int fd, const unsigned char *data, size_t n) {
+    while (n) {
+        ssize_t res = ::write(fd, data, n);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        data += res;
+        n -= res;
+    }
+    return true;
+}
+
+// Emits the balanced tree over sorted indices [l, r) in index order, so the
+// image is laid out in in-order and a full scan reads the file sequentially.
+template<class T, class C>
+template< class It >
+bool bst_mapped<T, C>::write_nodes(int fd, It& first, uint64_t l, uint64_t r, uint64_t parent,
+                                   unsigned char *buffer, size_t& used) {
+    if (l >= r) return true;
+    uint64_t mid = l + (r - l) / 2;
+    if (!write_nodes(fd, first, l, mid, offset_of(l, r), buffer, used)) return false;
+
+    Node node;
+    std::memset(&node, 0, sizeof(node));
+    node.value = *first;
+    ++first;
+    node.left = offset_of(l, mid);
+    node.right = offset_of(mid + 1, r);
+    node.prev = parent;
+    if (used + sizeof(Node) > buffer_bytes_) {
+        if (!write_all(fd, buffer, used)) return false;
+        used = 0;
+    }
+    std::memcpy(buffer + used, &node, sizeof(Node));
+    used += sizeof(Node);
+
+    return write_nodes(fd, first, mid + 1, r, offset_of(l, r), buffer, used);
+}
+
+template<class T, class C>
+template< class It >
+bool bst_mapped<T, C>::write(int fd, It first, size_type n) {
+    static_assert(std::is_trivially_copyable_v<T>, "bst_mapped requires trivially copyable T");
+    static_assert(sizeof(Node) <= buffer_bytes_, "value too large for the write buffer");
+    unsigned char buffer[buffer_bytes_];
+    std::memset(buffer, 0, nodes_offset_);
+    Header header = {magic_, sizeof(T), n, offset_of(0, n)};
+    std::memcpy(buffer, &header, sizeof(header));
+    size_t used = nodes_offset_;
+
+    if (!write_nodes(fd, first, 0, n, 0, buffer, used)) return false;
+    return write_all(fd, buffer, used);
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::valid_link(uint64_t offset, uint64_t end) {
+    return !offset || (offset >= nodes_offset_ && offset < end && (offset - nodes_offset_) % sizeof(Node) == 0);
+}
+
+// Full check of an open image, in one pass that reads every page: every link
+// must name one of the count node slots and every child must link back to
+// its parent. After it succeeds no traversal throws.
+template<class T, class C>
+bool bst_mapped<T, C>::verify() const {
+    if (!base_) return true;
+    const unsigned char *base = base_;
+    const Header *header = reinterpret_cast<const Header*>(base);
+    uint64_t end = nodes_offset_ + size_ * sizeof(Node);
+    if (!valid_link(header->root, end)) return false;
+    if (header->root && reinterpret_cast<const Node*>(base + header->root)->prev) return false;
+
+    for (uint64_t offset = nodes_offset_; offset < end; offset += sizeof(Node)) {
+        const Node *node = reinterpret_cast<const Node*>(base + offset);
+        if (!valid_link(node->left, end) || !valid_link(node->right, end) || !valid_link(node->prev, end)) return false;
+        if (node->left && (node->left == node->right)) return false;
+        if (node->left && reinterpret_cast<const Node*>(base + node->left)->prev != offset) return false;
+        if (node->right && reinterpret_cast<const Node*>(base + node->right)->prev != offset) return false;
+    }
+    return true;
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(nodes_offset_)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const Header *header = static_cast<const Header*>(map);
+    if (header->magic != magic_ || header->value_size != sizeof(T)
+        || header->count > (st.st_size - nodes_offset_) / sizeof(Node)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    base_ = static_cast<const unsigned char*>(map);
+    length_ = st.st_size;
+    limit_ = nodes_offset_ + (length_ - nodes_offset_) / sizeof(Node) * sizeof(Node);
+    size_ = header->count;
+    if (!valid_link(header->root, limit_) || (header->root && reinterpret_cast<const Node*>(base_ + header->root)->prev)) {
+        close();
+        return false;
+    }
+    root_ = node_at(base_, limit_, header->root);
+    return true;
+}
+
+template<class T, class C>
+void bst_mapped<T, C>::close() {
+    if (base_) munmap(const_cast<unsigned char*>(base_), length_);
+    base_ = nullptr;
+    length_ = 0;
+    limit_ = 0;
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::begin() const {
+    const Node *node = root_;
+    while (node && node->left) node = child(node, node->left);
+    return const_iterator(base_, limit_, node);
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::end() const {
+    return const_iterator(base_, limit_, nullptr);
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::cbegin() const {
+    return begin();
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::cend() const {
+    return end();
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_reverse_iterator bst_mapped<T, C>::rbegin() const {
+    return const_reverse_iterator(end());
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_reverse_iterator bst_mapped<T, C>::rend() const {
+    return const_reverse_iterator(begin());
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::empty() const {return size_ == 0;}
+
+template<class T, class C>
+typename bst_mapped<T, C>::size_type bst_mapped<T, C>::size() const {return size_;}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::lower_bound(const T& key) const {
+    const Node *node = root_, *res = nullptr;
+    while (node) {
+        if (comp_(node->value, key)) {
+            node = child(node, node->right);
+        } else {
+            res = node;
+            node = child(node, node->left);
+        }
+    }
+    return const_iterator(base_, limit_, res);
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::upper_bound(const T& key) const {
+    const Node *node = root_, *res = nullptr;
+    while (node) {
+        if (comp_(key, node->value)) {
+            res = node;
+            node = child(node, node->left);
+        } else {
+            node = child(node, node->right);
+        }
+    }
+    return const_iterator(base_, limit_, res);
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::const_iterator bst_mapped<T, C>::find(const T& key) const {
+    const_iterator pos = lower_bound(key);
+    if (pos.node_ && comp_(key, pos.node_->value)) return end();
+    return pos;
+}
+
+template<class T, class C>
+bool bst_mapped<T, C>::contains(const T& key) const {
+    return find(key) != end();
+}
+
+template<class T, class C>
+typename bst_mapped<T, C>::size_type bst_mapped<T, C>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template<class T, class C>
+std::pair<typename bst_mapped<T, C>::const_iterator, typename bst_mapped<T, C>::const_iterator> bst_mapped<T, C>::equal_range(const T& key) const {
+    return {lower_bound(key), upper_bound(key)};
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Memory report of one container, as returned by memory_usage(). node_bytes
+// covers the live nodes (value_bytes of it hold values, the rest is links and
+// padding). slack_bytes estimates what the allocator spends on top of the
+// requested node sizes, assuming a malloc-style heap with one size word per
+// chunk and two-word alignment, plus unused slots of a preallocated block.
+// auxiliary_bytes is the container object itself and nodes that were
+// detached by clear_incremental but not freed yet.
+struct bst_memory_usage {
+    size_t nodes = 0;
+    size_t node_bytes = 0;
+    size_t value_bytes = 0;
+    size_t slack_bytes = 0;
+    size_t auxiliary_bytes = 0;
+
+    size_t total() const;
+};
+
+inline size_t bst_memory_usage::total() const {
+    return node_bytes + slack_bytes + auxiliary_bytes;
+}
+
+// Estimated heap overhead of one separate allocation of bytes.
+inline size_t bst_allocation_slack(size_t bytes) {
+    const size_t word = sizeof(size_t), align = 2 * word;
+    size_t chunk = (bytes + word + align - 1) / align * align;
+    if (chunk < 2 * align) chunk = 2 * align;
+    return chunk - bytes;
+}
+
+
+// True if alloc draws from a std::pmr::monotonic_buffer_resource. Its
+// deallocate does nothing, so a container being destroyed need not return
+// its nodes one by one.
+template <class Alloc>
+bool bst_monotonic(const Alloc&) {
+    return false;
+}
+
+template <class U>
+bool bst_monotonic(const std::pmr::polymorphic_allocator<U>& alloc) {
+    return dynamic_cast<std::pmr::monotonic_buffer_resource*>(alloc.resource()) != nullptr;
+}
+
+
+// Returns free heap memory to the OS after a container released many small
+// allocations. Freed nodes stay resident in malloc's bins, and a large block
+// is not guaranteed to be unmapped either, because glibc raises its mmap
+// threshold dynamically. Only std::allocator draws from malloc, so for any
+// other allocator this does nothing; the same holds off glibc.
+template <class Alloc>
+void bst_trim_heap(const Alloc&) {}
+
+template <class U>
+void bst_trim_heap(const std::allocator<U>&) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+
+// Snapshot of a bst_counting_allocator's counters. allocation_rate() is in
+// allocations per second since the counters were created.
+struct bst_allocation_stats {
+    size_t live_bytes = 0;
+    size_t live_allocations = 0;
+    size_t peak_bytes = 0;
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t allocated_bytes = 0;
+    double seconds = 0;
+
+    double allocation_rate() const;
+};
+
+inline double bst_allocation_stats::allocation_rate() const {
+    return seconds > 0 ? allocations / seconds : 0;
+}
+
+class bst_allocation_counter {
+public:
+    bst_allocation_counter();
+    bst_allocation_counter(const bst_allocation_counter&) = delete;
+    bst_allocation_counter& operator=(const bst_allocation_counter&) = delete;
+
+    void allocated(size_t);
+    void deallocated(size_t);
+    bst_allocation_stats stats() const;
+
+private:
+    std::atomic<size_t> live_bytes_, live_allocations_, peak_bytes_;
+    std::atomic<size_t> allocations_, deallocations_, allocated_bytes_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline bst_allocation_counter::bst_allocation_counter():
+    live_bytes_(0), live_allocations_(0), peak_bytes_(0), allocations_(0), deallocations_(0), allocated_bytes_(0),
+    start_(std::chrono::steady_clock::now()) {}
+
+inline void bst_allocation_counter::allocated(size_t bytes) {
+    size_t live = live_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes_.load(std::memory_order_relaxed);
+    while ((peak < live) && !peak_bytes_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    live_allocations_.fetch_add(1, std::memory_order_relaxed);
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void bst_allocation_counter::deallocated(size_t bytes) {
+    live_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    live_allocations_.fetch_sub(1, std::memory_order_relaxed);
+    deallocations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline bst_allocation_stats bst_allocation_counter::stats() const {
+    bst_allocation_stats res;
+    res.live_bytes = live_bytes_.load(std::memory_order_relaxed);
+    res.live_allocations = live_allocations_.load(std::memory_order_relaxed);
+    res.peak_bytes = peak_bytes_.load(std::memory_order_relaxed);
+    res.allocations = allocations_.load(std::memory_order_relaxed);
+    res.deallocations = deallocations_.load(std::memory_order_relaxed);
+    res.allocated_bytes = allocated_bytes_.load(std::memory_order_relaxed);
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    return res;
+}
+
+
+// Allocator adapter that forwards to A and counts through a shared
+// bst_allocation_counter. A default constructed adapter starts its own
+// counter; copies and rebinds share it, so every allocation a container makes
+// (nodes, blocks, scratch buffers) lands in the counter of the allocator it
+// was constructed with, and get_allocator().stats() reads it back.
+template <class T, class A = std::allocator<T>>
+class bst_counting_allocator {
+public:
+    using AllocTraits = std::allocator_traits<A>;
+    typedef T value_type;
+    typedef typename AllocTraits::size_type size_type;
+    typedef typename AllocTraits::difference_type difference_type;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <class U>
+    struct rebind {
+        typedef bst_counting_allocator<U, typename AllocTraits::template rebind_alloc<U>> other;
+    };
+
+    bst_counting_allocator();
+    explicit bst_counting_allocator(const A&);
+    template <class U, class B>
+    bst_counting_allocator(const bst_counting_allocator<U, B>&);
+
+    T* allocate(size_type);
+    void deallocate(T *, size_type);
+
+    bst_allocation_stats stats() const;
+    std::shared_ptr<bst_allocation_counter> counter() const;
+
+    template <class U, class B>
+    bool operator==(const bst_counting_allocator<U, B>&) const;
+    template <class U, class B>
+    bool operator!=(const bst_counting_allocator<U, B>&) const;
+
+private:
+    template <class U, class B>
+    friend class bst_counting_allocator;
+
+    A base_;
+    std::shared_ptr<bst_allocation_counter> counter_;
+};
+
+
+template <class T, class A>
+bst_counting_allocator<T, A>::bst_counting_allocator(): base_(), counter_(std::make_shared<bst_allocation_counter>()) {}
+
+template <class T, class A>
+bst_counting_allocator<T, A>::bst_counting_allocator(const A& base):
+    base_(base), counter_(std::make_shared<bst_allocation_counter>()) {}
+
+template <class T, class A>
+template <class U, class B>
+bst_counting_allocator<T, A>::bst_counting_allocator(const bst_counting_allocator<U, B>& other):
+    base_(other.base_), counter_(other.counter_) {}
+
+template <class T, class A>
+T* bst_counting_allocator<T, A>::allocate(size_type n) {
+    T *res = AllocTraits::allocate(base_, n);
+    counter_->allocated(n * sizeof(T));
+    return res;
+}
+
+template <class T, class A>
+void bst_counting_allocator<T, A>::deallocate(T *ptr, size_type n) {
+    counter_->deallocated(n * sizeof(T));
+    AllocTraits::deallocate(base_, ptr, n);
+}
+
+template <class T, class A>
+bst_allocation_stats bst_counting_allocator<T, A>::stats() const {
+    return counter_->stats();
+}
+
+template <class T, class A>
+std::shared_ptr<bst_allocation_counter> bst_counting_allocator<T, A>::counter() const {
+    return counter_;
+}
+
+template <class T, class A>
+template <class U, class B>
+bool bst_counting_allocator<T, A>::operator==(const bst_counting_allocator<U, B>& other) const {
+    return (counter_ == other.counter_) && (base_ == other.base_);
+}
+
+template <class T, class A>
+template <class U, class B>
+bool bst_counting_allocator<T, A>::operator!=(const bst_counting_allocator<U, B>& other) const {
+    return !(*this == other);
+}
@@ -0,0 +1,432 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+// Persistent (functional) variant of bst_in. Nodes are immutable and reference
+// counted; insert and erase copy only the root-to-leaf path they change and
+// share every other subtree with older versions, so snapshot() is O(1).
+// Iterators walk one version by searching from its root, so they stay valid
+// for as long as that version is alive, whatever happens to later versions.
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+class bst_persistent {
+private:
+    struct Node {
+        T value;
+        Node *left, *right;
+        std::atomic<size_t> refs;
+        Node(const T& val);
+    };
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename A::size_type size_type;
+    typedef typename A::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef  A allocator_type;
+    typedef const T& reference;
+    typedef const T& const_reference;
+    using AllocTraits = std::allocator_traits<A>;
+    using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+    using NodeAllocTraits = typename AllocTraits::template rebind_traits<Node>;
+
+    class const_iterator {
+    public:
+        const Node *node_;
+        const Node *root_;
+        typedef typename A::difference_type difference_type;
+        typedef  T value_type;
+        typedef const T& reference;
+        typedef const T* pointer;
+        typedef std::bidirectional_iterator_tag iterator_category;
+
+        const_iterator();
+        const_iterator(const Node *, const Node *);
+
+        bool operator==(const const_iterator&) const;
+        bool operator!=(const const_iterator&) const;
+
+        const_iterator& operator++();
+        const_iterator& operator--();
+        const_iterator operator++(int);
+        const_iterator operator--(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+    };
+
+    typedef const_iterator iterator;
+    typedef typename std::reverse_iterator<const_iterator> reverse_iterator;
+    typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    bst_persistent();
+    bst_persistent(const bst_persistent&);
+    bst_persistent& operator=(const bst_persistent&);
+    ~bst_persistent();
+
+    bst_persistent snapshot() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    void swap(bst_persistent&);
+    size_type max_size() const;
+    bool empty() const;
+    size_type size() const;
+    allocator_type get_allocator() const;
+    void clear();
+
+    bool insert(const T&);
+    size_type erase(const T&);
+
+    size_type count(const T&) const;
+    const_iterator find(const T&) const;
+    bool contains(const T&) const;
+    const_iterator lower_bound(const T&) const;
+    const_iterator upper_bound(const T&) const;
+    std::pair<const_iterator, const_iterator> equal_range(const T&) const;
+
+private:
+    Node *root_;
+    size_t size_;
+    NodeAlloc alloc_;
+    C comp_;
+
+    Node* make_node(const T&);
+    static Node* acquire(Node *);
+    void release(Node *);
+    Node* copy_insert(Node *, const T&);
+    Node* copy_erase(Node *, const T&);
+    Node* copy_remove_min(Node *, const Node *&);
+};
+
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::Node::Node(const T& val): value(val), left(nullptr), right(nullptr), refs(1) {}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::const_iterator::const_iterator(): node_(nullptr), root_(nullptr) {}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::const_iterator::const_iterator(const Node *node, const Node *root): node_(node), root_(root) {}
+
+template<class T, class C, class A>
+bool bst_persistent<T, C, A>::const_iterator::operator==(const const_iterator& other) const {
+    return node_ == other.node_;
+}
+
+template<class T, class C, class A>
+bool bst_persistent<T, C, A>::const_iterator::operator!=(const const_iterator& other) const {
+    return node_ != other.node_;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator& bst_persistent<T, C, A>::const_iterator::operator++() {
+    if (!node_) return *this;
+    C comp;
+    const Node *node = root_, *next = nullptr;
+    while (node) {
+        if (comp(node_->value, node->value)) {
+            next = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    node_ = next;
+    return *this;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator& bst_persistent<T, C, A>::const_iterator::operator--() {
+    if (!node_) {
+        node_ = root_;
+        while (node_->right) node_ = node_->right;
+        return *this;
+    }
+    C comp;
+    const Node *node = root_, *prev = nullptr;
+    while (node) {
+        if (comp(node->value, node_->value)) {
+            prev = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    node_ = prev;
+    return *this;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::const_iterator::operator++(int) {
+    const_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::const_iterator::operator--(int) {
+    const_iterator res(*this);
+    --(*this);
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator::reference bst_persistent<T, C, A>::const_iterator::operator*() const {
+    return node_->value;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator::pointer bst_persistent<T, C, A>::const_iterator::operator->() const {
+    return &(node_->value);
+}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::bst_persistent(): root_(nullptr), size_(0), alloc_(), comp_() {}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::bst_persistent(const bst_persistent& other):
+    root_(acquire(other.root_)), size_(other.size_), alloc_(other.alloc_), comp_(other.comp_) {}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>& bst_persistent<T, C, A>::operator=(const bst_persistent& other) {
+    if (this == &other) return *this;
+    Node *old = root_;
+    root_ = acquire(other.root_);
+    size_ = other.size_;
+    release(old);
+    return *this;
+}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A>::~bst_persistent() {
+    release(root_);
+}
+
+template<class T, class C, class A>
+bst_persistent<T, C, A> bst_persistent<T, C, A>::snapshot() const {
+    return bst_persistent(*this);
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::Node* bst_persistent<T, C, A>::make_node(const T& value) {
+    Node *node = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, node, value);
+    return node;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::Node* bst_persistent<T, C, A>::acquire(Node *node) {
+    if (node) node->refs.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+template<class T, class C, class A>
+void bst_persistent<T, C, A>::release(Node *node) {
+    while (node && (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+        release(node->left);
+        Node *right = node->right;
+        NodeAllocTraits::destroy(alloc_, node);
+        NodeAllocTraits::deallocate(alloc_, node, 1);
+        node = right;
+    }
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::begin() const {
+    const Node *node = root_;
+    while (node && node->left) node = node->left;
+    return const_iterator(node, root_);
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::end() const {
+    return const_iterator(nullptr, root_);
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::cbegin() const {
+    return begin();
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::cend() const {
+    return end();
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_reverse_iterator bst_persistent<T, C, A>::rbegin() const {
+    return const_reverse_iterator(end());
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_reverse_iterator bst_persistent<T, C, A>::rend() const {
+    return const_reverse_iterator(begin());
+}
+
+template<class T, class C, class A>
+void bst_persistent<T, C, A>::swap(bst_persistent& other) {
+    if (this == &other) return;
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    std::swap(alloc_, other.alloc_);
+    std::swap(comp_, other.comp_);
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::size_type bst_persistent<T, C, A>::max_size() const {
+    return std::numeric_limits<difference_type>::max();
+}
+
+template<class T, class C, class A>
+bool bst_persistent<T, C, A>::empty() const {return size_ == 0;}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::size_type bst_persistent<T, C, A>::size() const {return size_;}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::allocator_type bst_persistent<T, C, A>::get_allocator() const {
+    return alloc_;
+}
+
+template<class T, class C, class A>
+void bst_persistent<T, C, A>::clear() {
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::Node* bst_persistent<T, C, A>::copy_insert(Node *node, const T& value) {
+    if (!node) return make_node(value);
+    Node *res = make_node(node->value);
+    if (comp_(value, node->value)) {
+        res->left = copy_insert(node->left, value);
+        res->right = acquire(node->right);
+    } else {
+        res->left = acquire(node->left);
+        res->right = copy_insert(node->right, value);
+    }
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::Node* bst_persistent<T, C, A>::copy_remove_min(Node *node, const Node *&min) {
+    if (!node->left) {
+        min = node;
+        return acquire(node->right);
+    }
+    Node *left = copy_remove_min(node->left, min);
+    Node *res = make_node(node->value);
+    res->left = left;
+    res->right = acquire(node->right);
+    return res;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::Node* bst_persistent<T, C, A>::copy_erase(Node *node, const T& key) {
+    if (comp_(key, node->value)) {
+        Node *res = make_node(node->value);
+        res->left = copy_erase(node->left, key);
+        res->right = acquire(node->right);
+        return res;
+    }
+    if (comp_(node->value, key)) {
+        Node *res = make_node(node->value);
+        res->left = acquire(node->left);
+        res->right = copy_erase(node->right, key);
+        return res;
+    }
+
+    if (!node->left) return acquire(node->right);
+    if (!node->right) return acquire(node->left);
+
+    const Node *min = nullptr;
+    Node *right = copy_remove_min(node->right, min);
+    Node *res = make_node(min->value);
+    res->left = acquire(node->left);
+    res->right = right;
+    return res;
+}
+
+template<class T, class C, class A>
+bool bst_persistent<T, C, A>::insert(const T& value) {
+    if (contains(value)) return false;
+    Node *old = root_;
+    root_ = copy_insert(root_, value);
+    release(old);
+    ++size_;
+    return true;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::size_type bst_persistent<T, C, A>::erase(const T& key) {
+    if (!contains(key)) return 0;
+    Node *old = root_;
+    root_ = copy_erase(root_, key);
+    release(old);
+    --size_;
+    return 1;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::find(const T& key) const {
+    const Node *node = root_;
+    while (node) {
+        if (comp_(key, node->value)) node = node->left;
+        else if (comp_(node->value, key)) node = node->right;
+        else break;
+    }
+    return const_iterator(node, root_);
+}
+
+template<class T, class C, class A>
+bool bst_persistent<T, C, A>::contains(const T& key) const {
+    return find(key) != end();
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::size_type bst_persistent<T, C, A>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::lower_bound(const T& key) const {
+    const Node *node = root_, *res = nullptr;
+    while (node) {
+        if (comp_(node->value, key)) {
+            node = node->right;
+        } else {
+            res = node;
+            node = node->left;
+        }
+    }
+    return const_iterator(res, root_);
+}
+
+template<class T, class C, class A>
+typename bst_persistent<T, C, A>::const_iterator bst_persistent<T, C, A>::upper_bound(const T& key) const {
+    const Node *node = root_, *res = nullptr;
+    while (node) {
+        if (comp_(key, node->value)) {
+            res = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return const_iterator(res, root_);
+}
+
+template<class T, class C, class A>
+std::pair<typename bst_persistent<T, C, A>::const_iterator, typename bst_persistent<T, C, A>::const_iterator> bst_persistent<T, C, A>::equal_range(const T& key) const {
+    return {lower_bound(key), upper_bound(key)};
+}
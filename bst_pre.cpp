@@ -1,24 +1,36 @@
 #pragma once
 
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <algorithm>
+#include <span>
+#include <ranges>
+#include "bst_link.cpp"
+#include "bst_memory.cpp"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <cerrno>
+#include <unistd.h>
 
 template <class T, class C = std::less<T>, class A = std::allocator<T>>
 class bst_pre {
 private:
     struct Node {
         T value;
-        Node *left, *right, *prev;
+        Node *left, *right;
+        bst_link<Node> prev;
         using allocator_type = A;
         Node(const T& val);
+        Node(const T& val, const A& alloc);
         void swap(Node& other);
     };
 public:
     using key_type = T;
     typedef  T value_type;
-    typedef typename A::size_type size_type;
-    typedef typename A::difference_type difference_type;
+    typedef typename std::allocator_traits<A>::size_type size_type;
+    typedef typename std::allocator_traits<A>::difference_type difference_type;
     typedef  C key_compare;
     typedef  C value_compare;
     typedef  A allocator_type;
@@ -36,7 +48,7 @@ public:
     public:
         Node *node_;
         Node *root_;
-        typedef typename A::difference_type difference_type;
+        typedef typename std::allocator_traits<A>::difference_type difference_type;
         typedef  T value_type;
         typedef T& reference;
         typedef const typename std::allocator_traits<A>::pointer pointer;
@@ -50,6 +62,8 @@ public:
 
         iterator& operator++();
         iterator& operator--();
+        iterator operator++(int);
+        iterator operator--(int);
 
         reference operator*() const;
         pointer operator->() const;
@@ -59,7 +73,7 @@ public:
     public:
         Node *node_;
         Node *root_;
-        typedef typename A::difference_type difference_type;
+        typedef typename std::allocator_traits<A>::difference_type difference_type;
         typedef  T value_type;
         typedef T& reference;
         typedef const typename std::allocator_traits<A>::pointer pointer;
@@ -75,15 +89,45 @@ public:
 
         const_iterator& operator++();
         const_iterator& operator--();
+        const_iterator operator++(int);
+        const_iterator operator--(int);
 
         reference operator*() const;
         pointer operator->() const;
     };
 
+    class range_iterator {
+    public:
+        Node *node_;
+        T lo_, hi_;
+        typedef typename std::allocator_traits<A>::difference_type difference_type;
+        typedef  T value_type;
+        typedef T& reference;
+        typedef const typename std::allocator_traits<A>::pointer pointer;
+        typedef std::forward_iterator_tag iterator_category;
+
+        range_iterator();
+        range_iterator(Node*, const T&, const T&);
+
+        bool operator==(const range_iterator&) const;
+        bool operator!=(const range_iterator&) const;
+
+        range_iterator& operator++();
+        range_iterator operator++(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+    private:
+        bool in_range() const;
+        void step();
+    };
+
     typedef typename std::reverse_iterator<iterator> reverse_iterator;
     typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
     
     bst_pre();
+    explicit bst_pre(const A&);
     bst_pre(const bst_pre&);
     bst_pre& operator=(const bst_pre&);
     ~bst_pre();
@@ -103,8 +147,10 @@ public:
     size_type max_size();
     bool empty();
     allocator_type get_allocator() const;
+    bst_memory_usage memory_usage() const;
     size_t size() const;
     void clear();
+    bool clear_incremental(size_type);
     std::pair<iterator, bool> insert(const value_type&);
     std::pair<iterator, bool> insert(node_type&);
     iterator erase(iterator);
@@ -112,20 +158,49 @@ public:
 
     node_type& extract(iterator);
     node_type& extract(const T&);
+    std::pair<iterator, bool> update_key(iterator, const T&);
     template< class C2 >
     void merge(bst_pre<T, C2, A>&);
+    void split(const T&, bst_pre&);
+    void join(bst_pre&);
 
     size_type count(const T&) const;
     iterator find( const T& );
     const_iterator find( const T& ) const;
     bool contains( const T& ) const;
+
+    std::ranges::subrange<range_iterator> subrange( const T&, const T& );
+
+    size_type copy_to(std::span<T>, const_iterator&) const;
+    template< class F >
+    void for_each_chunk(size_type, F) const;
+
+    bool serialize(int) const;
+    bool deserialize(int);
     
 private:
     Node* root_;
-    size_t size_;
+    // unknown_size_ after split/join until size() counts the nodes. The const
+    // recount caches through atomic_ref, so concurrent const calls are safe.
+    mutable size_t size_;
     NodeAlloc alloc_;
+    Node *reclaim_, *reclaim_list_;
+    // Nodes detached by clear_incremental and not freed yet.
+    size_t reclaim_count_;
+    static constexpr size_t unknown_size_ = std::numeric_limits<size_t>::max();
+    // Flag bit on a node's prev link: right child not read yet (deserialize).
+    static constexpr unsigned right_pending_ = 0;
 
     void node_dfs_destructor(Node *);
+    Node* clone_nodes(const Node *);
+    void destroy_nodes();
+    void unlink_node(Node *);
+    void reclaim_step(Node *&);
+    static void prefetch(const Node *);
+    static void split_nodes(Node *, const T&, Node *&, Node *&);
+    static Node* join_nodes(Node *, Node *);
+    static bool write_all(int, const unsigned char *, size_t);
+    static size_t read_some(int, unsigned char *, size_t);
 };
 
 template <class T, class C = std::less<T>, class A = std::allocator<T>>
@@ -141,6 +216,15 @@ bst_pre<T, C, A>::Node::Node(const T& val) {
     prev = nullptr;
 }
 
+// Used by allocators that construct with the allocator appended, such as
+// std::pmr::polymorphic_allocator; the value gets the allocator in turn.
+template<typename T, typename C, typename A>
+bst_pre<T, C, A>::Node::Node(const T& val, const A& alloc): value(std::make_obj_using_allocator<T>(alloc, val)) {
+    left = nullptr;
+    right = nullptr;
+    prev = nullptr;
+}
+
 template<typename T, typename C, typename A>
 void bst_pre<T, C, A>::Node::swap(Node& other) {
     if (this == &other) return;
@@ -159,6 +243,7 @@ bst_pre<T, C, A>::iterator::iterator(const iterator& other): node_(other.node_),
 template<typename T, typename C, typename A>
 typename bst_pre<T, C, A>::iterator& bst_pre<T, C, A>::iterator::operator=(const iterator& other) {
     node_ = other.node_;
+    root_ = other.root_;
     return *this;
 }
 
@@ -230,6 +315,20 @@ typename bst_pre<T,C,A>::iterator& bst_pre<T,C,A>::iterator::operator--() {
     return *this;
 }
 
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::iterator bst_pre<T,C,A>::iterator::operator++(int) {
+    iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::iterator bst_pre<T,C,A>::iterator::operator--(int) {
+    iterator res(*this);
+    --(*this);
+    return res;
+}
+
 template<typename T, typename C, typename A>
 typename bst_pre<T,C,A>::iterator::reference bst_pre<T,C,A>::iterator::operator*() const {
     return node_->value;
@@ -253,6 +352,7 @@ bst_pre<T, C, A>::const_iterator::const_iterator(const iterator& other): node_(o
 template<typename T, typename C, typename A>
 typename bst_pre<T, C, A>::const_iterator& bst_pre<T, C, A>::const_iterator::operator=(const const_iterator& other) {
     node_ = other.node_;
+    root_ = other.root_;
     return *this;
 }
 
@@ -324,6 +424,20 @@ typename bst_pre<T,C,A>::const_iterator& bst_pre<T,C,A>::const_iterator::operato
     return *this;
 }
 
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::const_iterator bst_pre<T,C,A>::const_iterator::operator++(int) {
+    const_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::const_iterator bst_pre<T,C,A>::const_iterator::operator--(int) {
+    const_iterator res(*this);
+    --(*this);
+    return res;
+}
+
 template<typename T, typename C, typename A>
 typename bst_pre<T,C,A>::const_iterator::reference bst_pre<T,C,A>::const_iterator::operator*() const {
     return node_->value;
@@ -333,36 +447,184 @@ typename bst_pre<T,C,A>::const_iterator::pointer bst_pre<T,C,A>::const_iterator:
     return &(node_->value);
 }
 
+//range iterator
 template<typename T, typename C, typename A>
-bst_pre<T,C,A>::bst_pre(): root_(nullptr), size_(0), alloc_() {}
+bst_pre<T, C, A>::range_iterator::range_iterator(): node_(nullptr), lo_(), hi_() {};
 
 template<typename T, typename C, typename A>
-bst_pre<T,C,A>::bst_pre(const bst_pre& other) {
-    root_ = other.root_;
-    size_ = other.size_;
-    alloc_ = other.alloc_;
+bst_pre<T, C, A>::range_iterator::range_iterator(Node *root, const T& lo, const T& hi): node_(root), lo_(lo), hi_(hi) {
+    while (node_ && !in_range()) step();
+}
+
+template<typename T, typename C, typename A>
+bool bst_pre<T, C, A>::range_iterator::operator==(const range_iterator& other) const {
+    return node_ == other.node_;
+}
+
+template<typename T, typename C, typename A>
+bool bst_pre<T, C, A>::range_iterator::operator!=(const range_iterator& other) const {
+    return node_ != other.node_;
+}
+
+template<typename T, typename C, typename A>
+bool bst_pre<T, C, A>::range_iterator::in_range() const {
+    return !(node_->value < lo_) && (node_->value < hi_);
+}
+
+template<typename T, typename C, typename A>
+void bst_pre<T, C, A>::range_iterator::step() {
+    if (node_->left && (lo_ < node_->value)) {
+        node_ = node_->left;
+        return;
+    }
+
+    if (node_->right && (node_->value < hi_)) {
+        node_ = node_->right;
+        return;
+    }
+
+    while (node_->prev) {
+        if ((node_->prev->left == node_) && node_->prev->right && (node_->prev->value < hi_)) {
+            node_ = node_->prev->right;
+            return;
+        }
+        node_ = node_->prev;
+    }
+    node_ = nullptr;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::range_iterator& bst_pre<T,C,A>::range_iterator::operator++() {
+    if (!node_) return *this;
+    step();
+    while (node_ && !in_range()) step();
+    return *this;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::range_iterator bst_pre<T,C,A>::range_iterator::operator++(int) {
+    range_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::range_iterator::reference bst_pre<T,C,A>::range_iterator::operator*() const {
+    return node_->value;
+}
+
+template<typename T, typename C, typename A>
+typename bst_pre<T,C,A>::range_iterator::pointer bst_pre<T,C,A>::range_iterator::operator->() const {
+    return &(node_->value);
+}
+
+template<typename T, typename C, typename A>
+bst_pre<T,C,A>::bst_pre(): root_(nullptr), size_(0), alloc_(), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0) {}
+
+template<typename T, typename C, typename A>
+bst_pre<T,C,A>::bst_pre(const A& alloc): root_(nullptr), size_(0), alloc_(alloc), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0) {}
+
+template<typename T, typename C, typename A>
+bst_pre<T,C,A>::bst_pre(const bst_pre& other): root_(nullptr), size_(other.size_), alloc_(other.alloc_), reclaim_(nullptr), reclaim_list_(nullptr), reclaim_count_(0) {
+    root_ = clone_nodes(other.root_);
 }
 
 template<class T, class C, class A>
 bst_pre<T, C, A>& bst_pre<T, C, A>::operator=(const bst_pre<T, C, A> &other) {
     if (this == &other) return *this;
-    root_ = other.root_;
+    clear();
+    root_ = clone_nodes(other.root_);
     size_ = other.size_;
-    alloc_ = other.alloc_;
+    return *this;
+}
+
+// Copies the tree below node shape for shape, walking it through the prev
+// links: a node's copy gets its left, then its right child before the walk
+// moves back up.
+template<class T, class C, class A>
+typename bst_pre<T,C,A>::Node* bst_pre<T,C,A>::clone_nodes(const Node *node) {
+    if (!node) return nullptr;
+    Node *res = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, res, node->value);
+    const Node *from = node;
+    Node *to = res;
+    while (true) {
+        const Node *child = nullptr;
+        if (from->left && !to->left) child = from->left;
+        else if (from->right && !to->right) child = from->right;
+        if (child) {
+            Node *copy = NodeAllocTraits::allocate(alloc_, 1);
+            NodeAllocTraits::construct(alloc_, copy, child->value);
+            copy->prev = to;
+            if (child == from->left) to->left = copy;
+            else to->right = copy;
+            from = child;
+            to = copy;
+        } else if (from == node) {
+            break;
+        } else {
+            from = from->prev;
+            to = to->prev;
+        }
+    }
+    return res;
 }
 
 template<typename T, typename C, typename A>
 void bst_pre<T, C, A>::node_dfs_destructor(Node *node) {
-    if (!node) return;
-    node_dfs_destructor(node->left);
-    node_dfs_destructor(node->right);
-    NodeAllocTraits::destroy(alloc_, node);
-    NodeAllocTraits::deallocate(alloc_, node, 1);
+    while (node) reclaim_step(node);
+}
+
+// Frees the tree below node with O(1) extra space: a left child is rotated up,
+// a node without one is freed and node moves on to its right child.
+template<typename T, typename C, typename A>
+void bst_pre<T, C, A>::reclaim_step(Node *&node) {
+    if (node->left) {
+        Node *left = node->left;
+        node->left = left->right;
+        left->right = node;
+        node = left;
+    } else {
+        Node *right = node->right;
+        NodeAllocTraits::destroy(alloc_, node);
+        NodeAllocTraits::deallocate(alloc_, node, 1);
+        node = right;
+    }
 }
 
 template<class T, class C, class A>
 bst_pre<T,C,A>::~bst_pre() {
-    node_dfs_destructor(root_);
+    // Memory from a monotonic resource goes back only with the resource, so
+    // nodes are just destroyed, and not even visited for trivially
+    // destructible T.
+    if (bst_monotonic(alloc_)) {
+        if constexpr (!std::is_trivially_destructible_v<T>) destroy_nodes();
+        return;
+    }
+    clear_incremental(std::numeric_limits<size_type>::max());
+}
+
+// Runs the value destructors of all nodes, pending ones included, without
+// deallocating them; the walk rotates left children up like reclaim_step.
+template<class T, class C, class A>
+void bst_pre<T,C,A>::destroy_nodes() {
+    clear_incremental(0);
+    while (reclaim_ || reclaim_list_) {
+        if (!reclaim_) {
+            reclaim_ = reclaim_list_;
+            reclaim_list_ = reclaim_->prev;
+        }
+        if (reclaim_->left) {
+            Node *left = reclaim_->left;
+            reclaim_->left = left->right;
+            left->right = reclaim_;
+            reclaim_ = left;
+        } else {
+            Node *right = reclaim_->right;
+            NodeAllocTraits::destroy(alloc_, reclaim_);
+            reclaim_ = right;
+        }
+    }
 }
 
 template<class T, class C, class A>
@@ -429,13 +691,16 @@ void bst_pre<T,C,A>::swap(bst_pre& other) {
     std::swap(alloc_, other.alloc_);
     std::swap(root_, other.root_);
     std::swap(size_, other.size_);
+    std::swap(reclaim_, other.reclaim_);
+    std::swap(reclaim_list_, other.reclaim_list_);
+    std::swap(reclaim_count_, other.reclaim_count_);
 }
 
 template<class T, class C, class A>
 typename bst_pre<T,C,A>::size_type bst_pre<T,C,A>::max_size() {return std::numeric_limits<difference_type>::max();}
 
 template<class T, class C, class A>
-bool bst_pre<T,C,A>::empty() {return size_ == 0;}
+bool bst_pre<T,C,A>::empty() {return !root_;}
 
 template<class T, class C, class A>
 typename bst_pre<T,C,A>::allocator_type bst_pre<T,C,A>::get_allocator() const {
@@ -443,7 +708,37 @@ typename bst_pre<T,C,A>::allocator_type bst_pre<T,C,A>::get_allocator() const {
 }
 
 template<class T, class C, class A>
-size_t bst_pre<T,C,A>::size() const {return size_;}
+bst_memory_usage bst_pre<T,C,A>::memory_usage() const {
+    bst_memory_usage res;
+    res.nodes = size();
+    res.node_bytes = res.nodes * sizeof(Node);
+    res.value_bytes = res.nodes * sizeof(T);
+    res.slack_bytes = (res.nodes + reclaim_count_) * bst_allocation_slack(sizeof(Node));
+    res.auxiliary_bytes = sizeof(*this) + reclaim_count_ * sizeof(Node);
+    return res;
+}
+
+template<class T, class C, class A>
+size_t bst_pre<T,C,A>::size() const {
+    std::atomic_ref<size_t> cached(size_);
+    size_t res = cached.load(std::memory_order_relaxed);
+    if (res != unknown_size_) return res;
+    res = 0;
+    const Node *node = root_;
+    while (node && node->left) node = node->left;
+    while (node) {
+        ++res;
+        if (node->right) {
+            node = node->right;
+            while (node->left) node = node->left;
+        } else {
+            while (node->prev && (node->prev->right == node)) node = node->prev;
+            node = node->prev;
+        }
+    }
+    cached.store(res, std::memory_order_relaxed);
+    return res;
+}
 
 template<class T, class C, class A>
 void bst_pre<T,C,A>::clear() {
@@ -452,6 +747,31 @@ void bst_pre<T,C,A>::clear() {
     root_ = nullptr;
 }
 
+// Detaches the current contents in O(1) and then spends at most budget steps
+// (one rotation or one free each) on detached nodes. Detached trees are queued
+// through the prev link of their roots. Returns true once nothing is pending.
+template<class T, class C, class A>
+bool bst_pre<T,C,A>::clear_incremental(size_type budget) {
+    if (root_) {
+        reclaim_count_ += size();
+        root_->prev = reclaim_list_;
+        reclaim_list_ = root_;
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    for (; budget; --budget) {
+        if (!reclaim_) {
+            if (!reclaim_list_) break;
+            reclaim_ = reclaim_list_;
+            reclaim_list_ = reclaim_->prev;
+        }
+        if (!reclaim_->left) --reclaim_count_;
+        reclaim_step(reclaim_);
+    }
+    return !reclaim_ && !reclaim_list_;
+}
+
 template<class T, class C, class A>
 std::pair<typename bst_pre<T,C,A>::iterator, bool> bst_pre<T,C,A>::insert(const value_type& value) {
     iterator v;
@@ -468,10 +788,10 @@ std::pair<typename bst_pre<T,C,A>::iterator, bool> bst_pre<T,C,A>::insert(const
 
     if (v.node_) return {v, false};
     else {
-        size_++;
+        if (size_ != unknown_size_) size_++;
         Node *node = NodeAllocTraits::allocate(alloc_, 1);
         NodeAllocTraits::construct(alloc_, node, value);
-        if (size_ == 1) root_ = node;
+        if (!prev.node_) root_ = node;
         v.node_ = node;
         node->prev = prev.node_;
         if (prev.node_ && (*prev < value)) prev.node_->right = node;
@@ -496,8 +816,8 @@ std::pair<typename bst_pre<T,C,A>::iterator, bool> bst_pre<T,C,A>::insert(node_t
 
     if (v.node_) return {v, false};
     else {
-        size_++;
-        if (size_ == 1) root_ = &node;
+        if (size_ != unknown_size_) size_++;
+        if (!prev.node_) root_ = &node;
         v.node_ = &node;
         node.prev = prev.node_;
         if (prev.node_ && (*prev < node.value)) prev.node_->right = &node;
@@ -509,201 +829,226 @@ std::pair<typename bst_pre<T,C,A>::iterator, bool> bst_pre<T,C,A>::insert(node_t
 template<class T, class C, class A>
 typename bst_pre<T,C,A>::iterator bst_pre<T,C,A>::erase(iterator pos) {
     if (!pos.node_) return pos;
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        NodeAllocTraits::destroy(alloc_, next.node_);
-        NodeAllocTraits::deallocate(alloc_, next.node_, 1);
-        return pos;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
-        }
-        pos.node_->left->prev = pos.node_->prev;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-        return next;
+    // The node that takes the erased one's place comes next in pre-order.
+    iterator next(pos);
+    Node *node = pos.node_;
+    if (node->left && node->right) {
+        next.node_ = node->right;
+        while (next.node_->left) next.node_ = next.node_->left;
+    } else if (node->left || node->right) {
+        next.node_ = node->left ? node->left : node->right;
     } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-        return next;
+        ++next;
     }
+    unlink_node(pos.node_);
+    if (size_ != unknown_size_) size_--;
+    NodeAllocTraits::destroy(alloc_, pos.node_);
+    NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
+    next.root_ = root_;
+    return next;
 }
 
 template<class T, class C, class A>
 typename bst_pre<T,C,A>::size_type bst_pre<T,C,A>::erase(const T& key) {
-
-    iterator pos;
-    pos.node_ = root_; pos.root_ = root_;
-
-    while (pos.node_ && (*pos != key)) {
-        if (*pos > key) pos.node_ = pos.node_->left;
-        else pos.node_ = pos.node_->right;
-    }
-
+    iterator pos = find(key);
     if (!pos.node_) return 0;
-    size_--;
-    if (size_ == 0) root_ = nullptr;
-
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        NodeAllocTraits::destroy(alloc_, next.node_);
-        NodeAllocTraits::deallocate(alloc_, next.node_, 1);
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
-        }
-        pos.node_->left->prev = pos.node_->prev;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-    } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        NodeAllocTraits::destroy(alloc_, pos.node_);
-        NodeAllocTraits::deallocate(alloc_, pos.node_, 1);
-    }
+    erase(pos);
     return 1;
 }
 
 template<class T, class C, class A>
 typename bst_pre<T,C,A>::node_type& bst_pre<T,C,A>::extract(iterator pos) {
     if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
-    size_--;
-    if (size_ == 0) root_ = nullptr;
+    unlink_node(pos.node_);
+    if (size_ != unknown_size_) size_--;
+    return *pos.node_;
+}
 
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
-        } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        return *next.node_;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+template<class T, class C, class A>
+typename bst_pre<T,C,A>::node_type& bst_pre<T,C,A>::extract(const T& key) {
+    iterator pos = find(key);
+    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
+    return extract(pos);
+}
+
+// Takes node out of the tree without freeing it, relinking its in-order
+// successor into its place when it has two children.
+template<class T, class C, class A>
+void bst_pre<T,C,A>::unlink_node(Node *node) {
+    Node *child = node->left ? node->left : node->right;
+    if (node->left && node->right) {
+        child = node->right;
+        while (child->left) child = child->left;
+        if (child != node->right) {
+            child->prev->left = child->right;
+            if (child->right) child->right->prev = child->prev;
+            child->right = node->right;
+            node->right->prev = child;
         }
-        pos.node_->left->prev = pos.node_->prev;
-        return *pos.node_;
+        child->left = node->left;
+        node->left->prev = child;
+    }
+    if (child) child->prev = node->prev;
+    if (!node->prev) root_ = child;
+    else if (node->prev->left == node) node->prev->left = child;
+    else node->prev->right = child;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->prev = nullptr;
+}
+
+// Gives the element at pos the key value, reusing its node: no allocation,
+// and pos stays valid. If value still lies between the in-order neighbours
+// the key is rewritten in place; otherwise the node is unlinked and linked
+// back in at its new position. Returns false, with the tree unchanged and an
+// iterator to the other element, if value is already present elsewhere.
+template<class T, class C, class A>
+std::pair<typename bst_pre<T,C,A>::iterator, bool> bst_pre<T,C,A>::update_key(iterator pos, const T& value) {
+    Node *node = pos.node_;
+    if (!node) return {pos, false};
+
+    Node *lo = node->left, *hi = node->right;
+    if (lo) {
+        while (lo->right) lo = lo->right;
+    } else {
+        lo = node;
+        while (lo->prev && (lo->prev->left == lo)) lo = lo->prev;
+        lo = lo->prev;
+    }
+    if (hi) {
+        while (hi->left) hi = hi->left;
     } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        return *pos.node_;
+        hi = node;
+        while (hi->prev && (hi->prev->right == hi)) hi = hi->prev;
+        hi = hi->prev;
+    }
+    if ((!lo || (lo->value < value)) && (!hi || (value < hi->value))) {
+        node->value = value;
+        return {pos, true};
+    }
+
+    iterator same = find(value);
+    if (same.node_) return {same, false};
+
+    unlink_node(node);
+    node->value = value;
+    Node *parent = nullptr, **link = &root_;
+    while (*link) {
+        parent = *link;
+        link = (value < parent->value) ? &parent->left : &parent->right;
     }
+    *link = node;
+    node->prev = parent;
+    pos.root_ = root_;
+    return {pos, true};
 }
 
 template<class T, class C, class A>
-typename bst_pre<T,C,A>::node_type& bst_pre<T,C,A>::extract(const T& key) {
+template< class C2 >
+void bst_pre<T,C,A>::merge(bst_pre<T,C2,A>& source) {
+    while (!source.empty()) {
+        insert(source.extract(source.begin()));
+    }
+}
 
-    iterator pos;
-    pos.node_ = root_; pos.root_ = root_;
+// Moves every key not less than key into greater, relinking O(h) nodes;
+// greater's previous contents are released. Sizes are recounted lazily.
+template<class T, class C, class A>
+void bst_pre<T,C,A>::split(const T& key, bst_pre& greater) {
+    if (this == &greater) return;
+    greater.clear();
+    if (!root_) return;
+
+    size_t total = size_;
+    split_nodes(root_, key, root_, greater.root_);
+    size_ = root_ ? unknown_size_ : 0;
+    greater.size_ = greater.root_ ? unknown_size_ : 0;
+    if (!root_) greater.size_ = total;
+    else if (!greater.root_) size_ = total;
+}
 
-    while (pos.node_ && (*pos != key)) {
-        if (*pos > key) pos.node_ = pos.node_->left;
-        else pos.node_ = pos.node_->right;
+// Appends other when the key ranges of the two trees do not overlap, lifting
+// the maximum of the lower tree into the root in O(h); otherwise falls back
+// to merge. other is left empty.
+template<class T, class C, class A>
+void bst_pre<T,C,A>::join(bst_pre& other) {
+    if ((this == &other) || !other.root_) return;
+    if (!root_) {
+        root_ = other.root_;
+        size_ = other.size_;
+        other.root_ = nullptr;
+        other.size_ = 0;
+        return;
     }
 
-    if (!pos.node_) return *(NodeAllocTraits::allocate(alloc_, 1));
-    size_--;
-    if (size_ == 0) root_ = nullptr;
+    const Node *max = root_, *other_min = other.root_;
+    while (max->right) max = max->right;
+    while (other_min->left) other_min = other_min->left;
+    const Node *min = root_, *other_max = other.root_;
+    while (min->left) min = min->left;
+    while (other_max->right) other_max = other_max->right;
+
+    if (max->value < other_min->value) {
+        root_ = join_nodes(root_, other.root_);
+    } else if (other_max->value < min->value) {
+        root_ = join_nodes(other.root_, root_);
+    } else {
+        merge(other);
+        return;
+    }
+    if ((size_ == unknown_size_) || (other.size_ == unknown_size_)) size_ = unknown_size_;
+    else size_ += other.size_;
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
 
-    if (pos.node_->right) {
-        iterator next(pos);
-        ++next;
-        std::swap(pos.node_->value, next.node_->value);
-        if (next.node_->right) {
-            next.node_->right->prev = next.node_->prev;
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = next.node_->right; 
-            } else {
-                next.node_->prev->right = next.node_->right;
-            }
+// Splits the subtree at node into keys less than key (left) and the rest
+// (right), relinking nodes top-down.
+template<class T, class C, class A>
+void bst_pre<T,C,A>::split_nodes(Node *node, const T& key, Node *&left, Node *&right) {
+    Node **left_link = &left, **right_link = &right;
+    Node *left_prev = nullptr, *right_prev = nullptr;
+    while (node) {
+        if (node->value < key) {
+            *left_link = node;
+            node->prev = left_prev;
+            left_prev = node;
+            left_link = &node->right;
+            node = node->right;
         } else {
-            if (next.node_->prev->left == next.node_) {
-               next.node_->prev->left = nullptr; 
-            } else {
-                next.node_->prev->right = nullptr;
-            }
-        }
-        return next.node_;
-    } else if (pos.node_->left) {
-        iterator next(pos); ++next;
-        if (root_ == pos.node_) root_ = pos.node_->left;
-        if (pos.node_->prev) {
-            if (pos.node_->prev->left == pos.node_) pos.node_->prev->left = pos.node_->left;
-            else pos.node_->prev->right = pos.node_->left;
+            *right_link = node;
+            node->prev = right_prev;
+            right_prev = node;
+            right_link = &node->left;
+            node = node->left;
         }
-        pos.node_->left->prev = pos.node_->prev;
-        return pos.node_;
-    } else {
-        iterator next; next.node_ = pos.node_; ++next;
-        if (root_ == pos.node_) root_ = nullptr;
-        return pos.node_;
     }
+    *left_link = nullptr;
+    *right_link = nullptr;
 }
 
+// Joins two subtrees where every key of left is less than every key of right
+// by lifting the maximum of left into the root. The result has no parent.
 template<class T, class C, class A>
-template< class C2 >
-void bst_pre<T,C,A>::merge(bst_pre<T,C2,A>& source) {
-    while (source.size()) {
-        insert(source.extract(source.begin()));
+typename bst_pre<T,C,A>::Node* bst_pre<T,C,A>::join_nodes(Node *left, Node *right) {
+    if (!left || !right) {
+        Node *res = left ? left : right;
+        if (res) res->prev = nullptr;
+        return res;
     }
+
+    Node *max = left;
+    while (max->right) max = max->right;
+    if (max != left) {
+        max->prev->right = max->left;
+        if (max->left) max->left->prev = max->prev;
+        max->left = left;
+        left->prev = max;
+    }
+    max->right = right;
+    right->prev = max;
+    max->prev = nullptr;
+    return max;
 }
 
 template<class T, class C, class A>
@@ -744,7 +1089,6 @@ typename bst_pre<T,C,A>::const_iterator bst_pre<T,C,A>::find(const T& key) const
         else pos.node_ = pos.node_->right;
     }
 
-    if (!pos.node_) return cend();
     return pos;
 }
 
@@ -762,12 +1106,200 @@ bool bst_pre<T,C,A>::contains(const T& key) const {
     return true;
 }
 
+template <class T, class C, class A>
+std::ranges::subrange<typename bst_pre<T,C,A>::range_iterator> bst_pre<T,C,A>::subrange(const T& lo, const T& hi) {
+    if (!(lo < hi)) return {range_iterator(), range_iterator()};
+    return {range_iterator(root_, lo, hi), range_iterator()};
+}
+
+template<class T, class C, class A>
+void bst_pre<T,C,A>::prefetch(const Node *node) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(node);
+#endif
+}
+
+template<class T, class C, class A>
+typename bst_pre<T,C,A>::size_type bst_pre<T,C,A>::copy_to(std::span<T> out, const_iterator& pos) const {
+    size_type n = 0;
+    while (pos.node_ && (n < out.size())) {
+        prefetch(pos.node_->left);
+        prefetch(pos.node_->right);
+        prefetch(pos.node_->prev);
+        out[n++] = pos.node_->value;
+        ++pos;
+    }
+    return n;
+}
+
+template<class T, class C, class A>
+template< class F >
+void bst_pre<T,C,A>::for_each_chunk(size_type chunk_size, F f) const {
+    if (!root_ || !chunk_size) return;
+    A alloc(alloc_);
+    T *buffer = AllocTraits::allocate(alloc, chunk_size);
+
+    const_iterator pos; pos.root_ = root_;
+    Node *node = root_;
+    pos.node_ = node;
+
+    while (pos.node_) {
+        size_type n = 0;
+        while (pos.node_ && (n < chunk_size)) {
+            prefetch(pos.node_->left);
+            prefetch(pos.node_->right);
+            prefetch(pos.node_->prev);
+            AllocTraits::construct(alloc, buffer + n, pos.node_->value);
+            ++n;
+            ++pos;
+        }
+        f(std::span<const T>(buffer, n));
+        for (size_type i = 0; i < n; ++i) AllocTraits::destroy(alloc, buffer + i);
+    }
+    AllocTraits::deallocate(alloc, buffer, chunk_size);
+}
+
+// Snapshot layout (native byte order): magic, sizeof(T), node count, then one
+// record per node in pre-order: the raw bytes of the value followed by a byte
+// with bit 0 set if the node has a left child and bit 1 if it has a right one.
+// Pre-order plus these bits fixes the shape, so loading needs no comparisons.
+template<class T, class C, class A>
+bool bst_pre<T,C,A>::write_all(int fd, const unsigned char *data, size_t n) {
+    while (n) {
+        ssize_t res = ::write(fd, data, n);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return false;
+        data += res;
+        n -= res;
+    }
+    return true;
+}
+
+template<class T, class C, class A>
+size_t bst_pre<T,C,A>::read_some(int fd, unsigned char *data, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t res = ::read(fd, data + got, n - got);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        got += res;
+    }
+    return got;
+}
+
+template<class T, class C, class A>
+bool bst_pre<T,C,A>::serialize(int fd) const {
+    static_assert(std::is_trivially_copyable_v<T>, "serialize requires trivially copyable T");
+    const size_t record = sizeof(T) + 1;
+    unsigned char buffer[1 << 16];
+    static_assert(record <= sizeof(buffer), "value too large for the snapshot buffer");
+    size_t used = 0;
+
+    uint64_t header[3] = {0x31455250545342ull, sizeof(T), size()};
+    std::memcpy(buffer, header, sizeof(header));
+    used = sizeof(header);
+
+    const_iterator pos; pos.node_ = root_; pos.root_ = root_;
+    for (; pos.node_; ++pos) {
+        if (used + record > sizeof(buffer)) {
+            if (!write_all(fd, buffer, used)) return false;
+            used = 0;
+        }
+        std::memcpy(buffer + used, &pos.node_->value, sizeof(T));
+        buffer[used + sizeof(T)] = (pos.node_->left ? 1 : 0) | (pos.node_->right ? 2 : 0);
+        used += record;
+    }
+    return write_all(fd, buffer, used);
+}
+
+template<class T, class C, class A>
+bool bst_pre<T,C,A>::deserialize(int fd) {
+    static_assert(std::is_trivially_copyable_v<T>, "deserialize requires trivially copyable T");
+    const size_t record = sizeof(T) + 1;
+    unsigned char buffer[1 << 16];
+    static_assert(record <= sizeof(buffer), "value too large for the snapshot buffer");
+    clear();
+
+    uint64_t header[3];
+    if (read_some(fd, buffer, sizeof(header)) != sizeof(header)) return false;
+    std::memcpy(header, buffer, sizeof(header));
+    if (header[0] != 0x31455250545342ull || header[1] != sizeof(T)) return false;
+
+    // A node whose right child is still to come has the right_pending_ flag
+    // set on its prev link; such nodes are always ancestors of the last node
+    // read.
+    Node *last = nullptr;
+    bool left_pending = false;
+    bool ok = true;
+    size_t used = 0, filled = 0;
+    uint64_t n = 0;
+    for (; n < header[2]; ++n) {
+        if (filled - used < record) {
+            std::memmove(buffer, buffer + used, filled - used);
+            filled -= used;
+            used = 0;
+            filled += read_some(fd, buffer + filled, sizeof(buffer) - filled);
+            if (filled < record) {
+                ok = false;
+                break;
+            }
+        }
+
+        Node *parent = last;
+        if (last && !left_pending) {
+            while (parent && !parent->prev.test(right_pending_)) parent = parent->prev;
+            if (!parent) {
+                ok = false;
+                break;
+            }
+        }
+
+        T value;
+        std::memcpy(&value, buffer + used, sizeof(T));
+        unsigned char flags = buffer[used + sizeof(T)];
+        used += record;
+
+        Node *node = NodeAllocTraits::allocate(alloc_, 1);
+        NodeAllocTraits::construct(alloc_, node, value);
+        node->prev = parent;
+        if (!parent) root_ = node;
+        else if (left_pending) parent->left = node;
+        else {
+            parent->right = node;
+            parent->prev.set(right_pending_, false);
+        }
+        if (flags & 2) node->prev.set(right_pending_, true);
+        left_pending = flags & 1;
+        last = node;
+    }
+
+    if (left_pending) ok = false;
+    for (Node *p = last; p; p = p->prev) {
+        if (p->prev.test(right_pending_)) {
+            p->prev.set(right_pending_, false);
+            ok = false;
+        }
+    }
+
+    size_ = n;
+    if (!ok) clear();
+    return ok;
+}
+
 template <class T, class C, class A>
 void swap(bst_pre<T,C,A>& lhs, bst_pre<T,C,A>& rhs) {
     if (lhs != rhs) {
         std::swap(lhs.alloc_, rhs.alloc_);
         std::swap(lhs.root_, rhs.root_);
         std::swap(lhs.size_, rhs.size_);
+        std::swap(lhs.reclaim_, rhs.reclaim_);
+        std::swap(lhs.reclaim_list_, rhs.reclaim_list_);
+        std::swap(lhs.reclaim_count_, rhs.reclaim_count_);
     }
 }
 
+
+namespace bst_pmr {
+    template <class T, class C = std::less<T>>
+    using bst_pre = ::bst_pre<T, C, std::pmr::polymorphic_allocator<T>>;
+}
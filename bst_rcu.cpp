@@ -0,0 +1,349 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include "bst_epoch.cpp"
+
+// Copy-on-write variant of bst_in for read-mostly data. Writers are
+// serialized, copy only the root-to-leaf path they change and publish the new
+// root with one atomic store; untouched subtrees are shared between versions.
+// Readers never lock: they pin an epoch, load the root and see one consistent
+// version. Replaced path nodes are retired and freed once no reader that
+// could still reach them is pinned.
+template <class T, class C = std::less<T>, class A = std::allocator<T>>
+class bst_rcu {
+private:
+    struct Node {
+        T value;
+        Node *left, *right;
+        Node *retired_next;
+        uint64_t retired_epoch;
+        Node(const T& val);
+    };
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename A::size_type size_type;
+    typedef typename A::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef  A allocator_type;
+    using AllocTraits = std::allocator_traits<A>;
+    using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+    using NodeAllocTraits = typename AllocTraits::template rebind_traits<Node>;
+    typedef bst_epoch::guard read_guard;
+
+    bst_rcu();
+    bst_rcu(const bst_rcu&) = delete;
+    bst_rcu& operator=(const bst_rcu&) = delete;
+    ~bst_rcu();
+
+    read_guard pin() const;
+
+    bool insert(const T&);
+    size_type erase(const T&);
+    void clear();
+
+    size_type size() const;
+    bool empty() const;
+    bool contains(const T&) const;
+    size_type count(const T&) const;
+    std::optional<T> find(const T&) const;
+    std::optional<T> lower_bound(const T&) const;
+    template< class F >
+    void for_each(F) const;
+
+    allocator_type get_allocator() const;
+
+private:
+    std::atomic<Node*> root_;
+    std::atomic<size_t> size_;
+    NodeAlloc alloc_;
+    C comp_;
+    std::mutex write_lock_;
+    mutable bst_epoch epoch_;
+    Node *pending_;
+    Node *retired_head_, *retired_tail_;
+
+    Node* make_node(const T&, Node *, Node *);
+    void free_node(Node *);
+    void retire(Node *);
+    void publish(Node *);
+    void reclaim();
+    void free_tree(Node *);
+    void retire_tree(Node *);
+
+    Node* copy_insert(Node *, const T&, bool&);
+    Node* copy_erase(Node *, const T&, bool&);
+    Node* copy_remove_min(Node *, Node *&);
+    template< class F >
+    static void visit(const Node *, F&);
+};
+
+
+template<class T, class C, class A>
+bst_rcu<T, C, A>::Node::Node(const T& val): value(val), left(nullptr), right(nullptr), retired_next(nullptr), retired_epoch(0) {}
+
+template<class T, class C, class A>
+bst_rcu<T, C, A>::bst_rcu(): root_(nullptr), size_(0), alloc_(), comp_(), pending_(nullptr), retired_head_(nullptr), retired_tail_(nullptr) {}
+
+template<class T, class C, class A>
+bst_rcu<T, C, A>::~bst_rcu() {
+    free_tree(root_.load());
+    for (Node *node = pending_; node; ) {
+        Node *next = node->retired_next;
+        free_node(node);
+        node = next;
+    }
+    for (Node *node = retired_head_; node; ) {
+        Node *next = node->retired_next;
+        free_node(node);
+        node = next;
+    }
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::read_guard bst_rcu<T, C, A>::pin() const {
+    return read_guard(epoch_);
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::Node* bst_rcu<T, C, A>::make_node(const T& value, Node *left, Node *right) {
+    Node *node = NodeAllocTraits::allocate(alloc_, 1);
+    NodeAllocTraits::construct(alloc_, node, value);
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::free_node(Node *node) {
+    NodeAllocTraits::destroy(alloc_, node);
+    NodeAllocTraits::deallocate(alloc_, node, 1);
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::free_tree(Node *node) {
+    while (node) {
+        free_tree(node->left);
+        Node *right = node->right;
+        free_node(node);
+        node = right;
+    }
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::retire(Node *node) {
+    node->retired_next = pending_;
+    pending_ = node;
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::retire_tree(Node *node) {
+    while (node) {
+        retire_tree(node->left);
+        retire(node);
+        node = node->right;
+    }
+}
+
+// Publishes the new version, then moves the nodes it replaced to the tail of
+// the retired queue. Tags are non-decreasing along the queue, so reclaim can
+// stop at the first node that is still visible to some reader.
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::publish(Node *root) {
+    root_.store(root);
+    uint64_t epoch = epoch_.advance();
+    while (pending_) {
+        Node *node = pending_;
+        pending_ = node->retired_next;
+        node->retired_next = nullptr;
+        node->retired_epoch = epoch;
+        if (retired_tail_) retired_tail_->retired_next = node;
+        else retired_head_ = node;
+        retired_tail_ = node;
+    }
+    reclaim();
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::reclaim() {
+    while (retired_head_ && epoch_.safe(retired_head_->retired_epoch)) {
+        Node *node = retired_head_;
+        retired_head_ = node->retired_next;
+        free_node(node);
+    }
+    if (!retired_head_) retired_tail_ = nullptr;
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::Node* bst_rcu<T, C, A>::copy_insert(Node *node, const T& value, bool& inserted) {
+    if (!node) {
+        inserted = true;
+        return make_node(value, nullptr, nullptr);
+    }
+
+    if (comp_(value, node->value)) {
+        Node *left = copy_insert(node->left, value, inserted);
+        if (!inserted) return node;
+        retire(node);
+        return make_node(node->value, left, node->right);
+    }
+    if (comp_(node->value, value)) {
+        Node *right = copy_insert(node->right, value, inserted);
+        if (!inserted) return node;
+        retire(node);
+        return make_node(node->value, node->left, right);
+    }
+    return node;
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::Node* bst_rcu<T, C, A>::copy_remove_min(Node *node, Node *&min) {
+    retire(node);
+    if (!node->left) {
+        min = node;
+        return node->right;
+    }
+    Node *left = copy_remove_min(node->left, min);
+    return make_node(node->value, left, node->right);
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::Node* bst_rcu<T, C, A>::copy_erase(Node *node, const T& key, bool& erased) {
+    if (!node) return nullptr;
+
+    if (comp_(key, node->value)) {
+        Node *left = copy_erase(node->left, key, erased);
+        if (!erased) return node;
+        retire(node);
+        return make_node(node->value, left, node->right);
+    }
+    if (comp_(node->value, key)) {
+        Node *right = copy_erase(node->right, key, erased);
+        if (!erased) return node;
+        retire(node);
+        return make_node(node->value, node->left, right);
+    }
+
+    erased = true;
+    retire(node);
+    if (!node->left) return node->right;
+    if (!node->right) return node->left;
+
+    Node *min = nullptr;
+    Node *right = copy_remove_min(node->right, min);
+    return make_node(min->value, node->left, right);
+}
+
+template<class T, class C, class A>
+bool bst_rcu<T, C, A>::insert(const T& value) {
+    std::lock_guard<std::mutex> lock(write_lock_);
+    bool inserted = false;
+    Node *root = copy_insert(root_.load(), value, inserted);
+    if (!inserted) return false;
+    size_.store(size_.load() + 1);
+    publish(root);
+    return true;
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::size_type bst_rcu<T, C, A>::erase(const T& key) {
+    std::lock_guard<std::mutex> lock(write_lock_);
+    bool erased = false;
+    Node *root = copy_erase(root_.load(), key, erased);
+    if (!erased) return 0;
+    size_.store(size_.load() - 1);
+    publish(root);
+    return 1;
+}
+
+template<class T, class C, class A>
+void bst_rcu<T, C, A>::clear() {
+    std::lock_guard<std::mutex> lock(write_lock_);
+    retire_tree(root_.load());
+    size_.store(0);
+    publish(nullptr);
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::size_type bst_rcu<T, C, A>::size() const {
+    return size_.load();
+}
+
+template<class T, class C, class A>
+bool bst_rcu<T, C, A>::empty() const {
+    return size() == 0;
+}
+
+template<class T, class C, class A>
+std::optional<T> bst_rcu<T, C, A>::find(const T& key) const {
+    read_guard guard(epoch_);
+    const Node *node = root_.load();
+    while (node) {
+        if (comp_(key, node->value)) node = node->left;
+        else if (comp_(node->value, key)) node = node->right;
+        else return node->value;
+    }
+    return std::nullopt;
+}
+
+template<class T, class C, class A>
+bool bst_rcu<T, C, A>::contains(const T& key) const {
+    read_guard guard(epoch_);
+    const Node *node = root_.load();
+    while (node) {
+        if (comp_(key, node->value)) node = node->left;
+        else if (comp_(node->value, key)) node = node->right;
+        else return true;
+    }
+    return false;
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::size_type bst_rcu<T, C, A>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template<class T, class C, class A>
+std::optional<T> bst_rcu<T, C, A>::lower_bound(const T& key) const {
+    read_guard guard(epoch_);
+    const Node *node = root_.load(), *res = nullptr;
+    while (node) {
+        if (comp_(node->value, key)) {
+            node = node->right;
+        } else {
+            res = node;
+            node = node->left;
+        }
+    }
+    if (!res) return std::nullopt;
+    return res->value;
+}
+
+template<class T, class C, class A>
+template< class F >
+void bst_rcu<T, C, A>::visit(const Node *node, F& f) {
+    while (node) {
+        visit(node->left, f);
+        f(node->value);
+        node = node->right;
+    }
+}
+
+// Visits one consistent version in order; writers are not blocked meanwhile.
+template<class T, class C, class A>
+template< class F >
+void bst_rcu<T, C, A>::for_each(F f) const {
+    read_guard guard(epoch_);
+    visit(root_.load(), f);
+}
+
+template<class T, class C, class A>
+typename bst_rcu<T, C, A>::allocator_type bst_rcu<T, C, A>::get_allocator() const {
+    return alloc_;
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include "bst_in.cpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#endif
+
+// Replica placement policies for bst_replicated. A policy reports how many
+// replica groups exist and which group the calling thread belongs to.
+
+// One group per CPU package, read from sysfs; the caller's group follows the
+// CPU it is currently running on.
+class bst_socket_placement {
+public:
+    static constexpr size_t max_cpus = 1024;
+
+    bst_socket_placement();
+    size_t groups() const;
+    size_t group_of() const;
+
+private:
+    unsigned short package_[max_cpus];
+    size_t groups_;
+};
+
+// Simulated groups: threads are spread over a fixed number of groups by the
+// hash of their id, so replication can be exercised on a single socket.
+class bst_thread_placement {
+public:
+    explicit bst_thread_placement(size_t groups = 2);
+    size_t groups() const;
+    size_t group_of() const;
+
+private:
+    size_t groups_;
+};
+
+
+inline bst_socket_placement::bst_socket_placement(): package_(), groups_(1) {
+#ifdef __linux__
+    size_t cpus = get_nprocs_conf();
+    if (cpus > max_cpus) cpus = max_cpus;
+    for (size_t cpu = 0; cpu < cpus; ++cpu) {
+        char path[96], buffer[16] = {};
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/physical_package_id", cpu);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        if (read(fd, buffer, sizeof(buffer) - 1) > 0) package_[cpu] = strtoul(buffer, nullptr, 10);
+        close(fd);
+        if (package_[cpu] >= groups_) groups_ = package_[cpu] + 1;
+    }
+#endif
+}
+
+inline size_t bst_socket_placement::groups() const {
+    return groups_;
+}
+
+inline size_t bst_socket_placement::group_of() const {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if ((cpu >= 0) && (static_cast<size_t>(cpu) < max_cpus)) return package_[cpu];
+#endif
+    return 0;
+}
+
+inline bst_thread_placement::bst_thread_placement(size_t groups): groups_(groups ? groups : 1) {}
+
+inline size_t bst_thread_placement::groups() const {
+    return groups_;
+}
+
+inline size_t bst_thread_placement::group_of() const {
+    return std::hash<std::thread::id>()(std::this_thread::get_id()) % groups_;
+}
+
+
+// Replicated bst_in in the style of node replication: every placement group
+// owns a full copy of the tree, and writers only append operations to a
+// shared ring log. A replica applies the log up to its tail before it serves
+// a read, so reads only touch memory of the reader's own group (nodes are
+// allocated by the thread that applies the log, i.e. first-touch local).
+// A writer brings its own replica up to date to report its result, and before
+// the ring wraps it catches up any replica that lags a full log behind.
+template <class T, class P = bst_socket_placement, class C = std::less<T>, class A = std::allocator<T>>
+class bst_replicated {
+private:
+    struct Op {
+        T value;
+        bool erased;
+        Op(const T&, bool);
+    };
+
+public:
+    typedef bst_in<T, C, A> replica_type;
+    typedef P placement_type;
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename replica_type::size_type size_type;
+    typedef typename replica_type::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  A allocator_type;
+
+    static constexpr size_t default_log_capacity = 4096;
+
+    explicit bst_replicated(const P& placement = P(), size_t log_capacity = default_log_capacity);
+    bst_replicated(const bst_replicated&) = delete;
+    bst_replicated& operator=(const bst_replicated&) = delete;
+    ~bst_replicated();
+
+    bool insert(const T&);
+    size_type erase(const T&);
+
+    bool contains(const T&) const;
+    size_type count(const T&) const;
+    std::optional<T> find(const T&) const;
+    size_type size() const;
+    bool empty() const;
+    template< class F >
+    void for_each(F) const;
+
+    size_t replicas() const;
+    void sync() const;
+
+private:
+    struct Replica {
+        replica_type tree;
+        std::shared_mutex lock;
+        std::atomic<size_t> applied;
+        Replica();
+    };
+
+    using AllocTraits = std::allocator_traits<A>;
+    using ReplicaAlloc = typename AllocTraits::template rebind_alloc<Replica>;
+    using ReplicaAllocTraits = typename AllocTraits::template rebind_traits<Replica>;
+    using OpAlloc = typename AllocTraits::template rebind_alloc<Op>;
+    using OpAllocTraits = typename AllocTraits::template rebind_traits<Op>;
+
+    P placement_;
+    ReplicaAlloc replica_alloc_;
+    OpAlloc op_alloc_;
+    Replica *replicas_;
+    size_t replica_count_;
+    Op *log_;
+    size_t log_capacity_;
+    std::atomic<size_t> tail_;
+    std::mutex log_lock_;
+
+    Replica& local() const;
+    Replica& synced() const;
+    void apply(Replica&, size_t) const;
+    bool write(const T&, bool);
+};
+
+
+template <class T, class P, class C, class A>
+bst_replicated<T, P, C, A>::Op::Op(const T& val, bool erase): value(val), erased(erase) {}
+
+template <class T, class P, class C, class A>
+bst_replicated<T, P, C, A>::Replica::Replica(): tree(), lock(), applied(0) {}
+
+template <class T, class P, class C, class A>
+bst_replicated<T, P, C, A>::bst_replicated(const P& placement, size_t log_capacity):
+    placement_(placement), replica_alloc_(), op_alloc_(), replicas_(nullptr), replica_count_(placement_.groups()),
+    log_(nullptr), log_capacity_(log_capacity ? log_capacity : 1), tail_(0) {
+    replicas_ = ReplicaAllocTraits::allocate(replica_alloc_, replica_count_);
+    for (size_t i = 0; i < replica_count_; ++i) ReplicaAllocTraits::construct(replica_alloc_, replicas_ + i);
+    log_ = OpAllocTraits::allocate(op_alloc_, log_capacity_);
+}
+
+template <class T, class P, class C, class A>
+bst_replicated<T, P, C, A>::~bst_replicated() {
+    size_t used = std::min(tail_.load(), log_capacity_);
+    for (size_t i = 0; i < used; ++i) OpAllocTraits::destroy(op_alloc_, log_ + i);
+    OpAllocTraits::deallocate(op_alloc_, log_, log_capacity_);
+    for (size_t i = 0; i < replica_count_; ++i) ReplicaAllocTraits::destroy(replica_alloc_, replicas_ + i);
+    ReplicaAllocTraits::deallocate(replica_alloc_, replicas_, replica_count_);
+}
+
+template <class T, class P, class C, class A>
+typename bst_replicated<T, P, C, A>::Replica& bst_replicated<T, P, C, A>::local() const {
+    return replicas_[placement_.group_of() % replica_count_];
+}
+
+// Applies log entries [applied, upto) to replica; the caller holds its lock
+// exclusively. Entries below the tail are never overwritten while a replica
+// still needs them, so they can be read without the log lock. A caller with
+// a stale upto finds the replica already past it and changes nothing.
+template <class T, class P, class C, class A>
+void bst_replicated<T, P, C, A>::apply(Replica& replica, size_t upto) const {
+    size_t from = replica.applied.load();
+    if (from >= upto) return;
+    for (size_t i = from; i < upto; ++i) {
+        const Op& op = log_[i % log_capacity_];
+        if (op.erased) replica.tree.erase(op.value);
+        else replica.tree.insert(op.value);
+    }
+    replica.applied.store(upto);
+}
+
+// Returns the caller's replica, brought up to the current tail.
+template <class T, class P, class C, class A>
+typename bst_replicated<T, P, C, A>::Replica& bst_replicated<T, P, C, A>::synced() const {
+    Replica& replica = local();
+    size_t tail = tail_.load();
+    if (replica.applied.load() < tail) {
+        std::unique_lock<std::shared_mutex> lock(replica.lock);
+        apply(replica, tail_.load());
+    }
+    return replica;
+}
+
+template <class T, class P, class C, class A>
+bool bst_replicated<T, P, C, A>::write(const T& value, bool erase) {
+    Replica& replica = local();
+    std::lock_guard<std::mutex> log_lock(log_lock_);
+    size_t tail = tail_.load();
+
+    if (tail >= log_capacity_) {
+        for (size_t i = 0; i < replica_count_; ++i) {
+            if (tail - replicas_[i].applied.load() < log_capacity_) continue;
+            std::unique_lock<std::shared_mutex> lock(replicas_[i].lock);
+            apply(replicas_[i], tail);
+        }
+    }
+
+    // The result is taken before the entry is published: once tail_ moves, a
+    // reader of this group may apply the entry first.
+    std::unique_lock<std::shared_mutex> lock(replica.lock);
+    apply(replica, tail);
+    bool changed = (replica.tree.contains(value) == erase);
+
+    if (tail >= log_capacity_) log_[tail % log_capacity_] = Op(value, erase);
+    else OpAllocTraits::construct(op_alloc_, log_ + tail, value, erase);
+    tail_.store(tail + 1);
+    apply(replica, tail + 1);
+    return changed;
+}
+
+template <class T, class P, class C, class A>
+bool bst_replicated<T, P, C, A>::insert(const T& value) {
+    return write(value, false);
+}
+
+template <class T, class P, class C, class A>
+typename bst_replicated<T, P, C, A>::size_type bst_replicated<T, P, C, A>::erase(const T& key) {
+    return write(key, true) ? 1 : 0;
+}
+
+template <class T, class P, class C, class A>
+bool bst_replicated<T, P, C, A>::contains(const T& key) const {
+    Replica& replica = synced();
+    std::shared_lock<std::shared_mutex> lock(replica.lock);
+    return replica.tree.contains(key);
+}
+
+template <class T, class P, class C, class A>
+typename bst_replicated<T, P, C, A>::size_type bst_replicated<T, P, C, A>::count(const T& key) const {
+    return contains(key) ? 1 : 0;
+}
+
+template <class T, class P, class C, class A>
+std::optional<T> bst_replicated<T, P, C, A>::find(const T& key) const {
+    Replica& replica = synced();
+    std::shared_lock<std::shared_mutex> lock(replica.lock);
+    typename replica_type::const_iterator pos = static_cast<const replica_type&>(replica.tree).find(key);
+    if (!pos.node_) return std::nullopt;
+    return *pos;
+}
+
+template <class T, class P, class C, class A>
+typename bst_replicated<T, P, C, A>::size_type bst_replicated<T, P, C, A>::size() const {
+    Replica& replica = synced();
+    std::shared_lock<std::shared_mutex> lock(replica.lock);
+    return replica.tree.size();
+}
+
+template <class T, class P, class C, class A>
+bool bst_replicated<T, P, C, A>::empty() const {
+    return size() == 0;
+}
+
+// Visits the caller's replica in order under its shared lock; writers keep
+// appending to the log meanwhile, so the walk sees one consistent prefix.
+template <class T, class P, class C, class A>
+template< class F >
+void bst_replicated<T, P, C, A>::for_each(F f) const {
+    Replica& replica = synced();
+    std::shared_lock<std::shared_mutex> lock(replica.lock);
+    replica.tree.for_each_chunk(256, [&f](std::span<const T> chunk) {
+        for (const T& value : chunk) f(value);
+    });
+}
+
+template <class T, class P, class C, class A>
+size_t bst_replicated<T, P, C, A>::replicas() const {
+    return replica_count_;
+}
+
+template <class T, class P, class C, class A>
+void bst_replicated<T, P, C, A>::sync() const {
+    synced();
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <shared_mutex>
+#include <mutex>
+#include "bst_in.cpp"
+
+// Range-sharded concurrent facade over bst_in. The key space is cut by N - 1
+// ascending split keys; shard i owns [bounds[i - 1], bounds[i]) and is guarded
+// by its own shared_mutex, so readers only contend with writers of the same
+// range. Because shards are ordered, concatenating them yields sorted order.
+template <class T, size_t N, class C = std::less<T>, class A = std::allocator<T>>
+class bst_sharded {
+public:
+    typedef bst_in<T, C, A> shard_type;
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename shard_type::size_type size_type;
+    typedef typename shard_type::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  A allocator_type;
+
+    // Not synchronized with writers: iterate only while no thread modifies
+    // the container, or use for_each which takes the shard locks.
+    class const_iterator {
+    public:
+        bst_sharded *owner_;
+        size_t shard_;
+        typename shard_type::const_iterator pos_;
+        typedef typename shard_type::difference_type difference_type;
+        typedef  T value_type;
+        typedef const T& reference;
+        typedef const T* pointer;
+        typedef std::forward_iterator_tag iterator_category;
+
+        const_iterator();
+        const_iterator(bst_sharded *, size_t, typename shard_type::const_iterator);
+
+        bool operator==(const const_iterator&) const;
+        bool operator!=(const const_iterator&) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+    private:
+        void skip_empty();
+    };
+
+    bst_sharded(std::initializer_list<T>);
+    bst_sharded(const bst_sharded&) = delete;
+    bst_sharded& operator=(const bst_sharded&) = delete;
+
+    const_iterator begin();
+    const_iterator end();
+
+    bool insert(const T&);
+    size_type erase(const T&);
+    void clear();
+
+    bool contains(const T&) const;
+    size_type count(const T&) const;
+    std::optional<T> find(const T&) const;
+    size_type size() const;
+    bool empty() const;
+
+    template< class F >
+    void for_each(F) const;
+
+    size_t shard_of(const T&) const;
+
+private:
+    static_assert(N > 0, "bst_sharded needs at least one shard");
+
+    shard_type shards_[N];
+    mutable std::shared_mutex locks_[N];
+    T bounds_[N];
+    C comp_;
+};
+
+
+template <class T, size_t N, class C, class A>
+bst_sharded<T, N, C, A>::const_iterator::const_iterator(): owner_(nullptr), shard_(0), pos_() {}
+
+template <class T, size_t N, class C, class A>
+bst_sharded<T, N, C, A>::const_iterator::const_iterator(bst_sharded *owner, size_t shard, typename shard_type::const_iterator pos):
+    owner_(owner), shard_(shard), pos_(pos) {
+    skip_empty();
+}
+
+template <class T, size_t N, class C, class A>
+void bst_sharded<T, N, C, A>::const_iterator::skip_empty() {
+    while (!pos_.node_ && (shard_ + 1 < N)) {
+        ++shard_;
+        pos_ = owner_->shards_[shard_].cbegin();
+    }
+}
+
+template <class T, size_t N, class C, class A>
+bool bst_sharded<T, N, C, A>::const_iterator::operator==(const const_iterator& other) const {
+    return (shard_ == other.shard_) && (pos_ == other.pos_);
+}
+
+template <class T, size_t N, class C, class A>
+bool bst_sharded<T, N, C, A>::const_iterator::operator!=(const const_iterator& other) const {
+    return !(*this == other);
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator& bst_sharded<T, N, C, A>::const_iterator::operator++() {
+    ++pos_;
+    skip_empty();
+    return *this;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator bst_sharded<T, N, C, A>::const_iterator::operator++(int) {
+    const_iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator::reference bst_sharded<T, N, C, A>::const_iterator::operator*() const {
+    return *pos_;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator::pointer bst_sharded<T, N, C, A>::const_iterator::operator->() const {
+    return &(*pos_);
+}
+
+// shard_of and the sorted order of for_each rely on the split keys, so
+// anything but N - 1 strictly ascending keys is rejected.
+template <class T, size_t N, class C, class A>
+bst_sharded<T, N, C, A>::bst_sharded(std::initializer_list<T> bounds): bounds_(), comp_() {
+    if (bounds.size() != N - 1) throw std::invalid_argument("bst_sharded: expected N - 1 split keys");
+    size_t i = 0;
+    for (const T& bound : bounds) {
+        if (i && !comp_(bounds_[i - 1], bound)) throw std::invalid_argument("bst_sharded: split keys not strictly ascending");
+        bounds_[i++] = bound;
+    }
+}
+
+template <class T, size_t N, class C, class A>
+size_t bst_sharded<T, N, C, A>::shard_of(const T& key) const {
+    size_t lo = 0, hi = N - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (comp_(key, bounds_[mid])) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator bst_sharded<T, N, C, A>::begin() {
+    return const_iterator(this, 0, shards_[0].cbegin());
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::const_iterator bst_sharded<T, N, C, A>::end() {
+    return const_iterator(this, N - 1, shards_[N - 1].cend());
+}
+
+template <class T, size_t N, class C, class A>
+bool bst_sharded<T, N, C, A>::insert(const T& value) {
+    size_t i = shard_of(value);
+    std::unique_lock<std::shared_mutex> lock(locks_[i]);
+    return shards_[i].insert(value).second;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::size_type bst_sharded<T, N, C, A>::erase(const T& key) {
+    size_t i = shard_of(key);
+    std::unique_lock<std::shared_mutex> lock(locks_[i]);
+    return shards_[i].erase(key);
+}
+
+template <class T, size_t N, class C, class A>
+void bst_sharded<T, N, C, A>::clear() {
+    for (size_t i = 0; i < N; ++i) {
+        std::unique_lock<std::shared_mutex> lock(locks_[i]);
+        shards_[i].clear();
+    }
+}
+
+template <class T, size_t N, class C, class A>
+bool bst_sharded<T, N, C, A>::contains(const T& key) const {
+    size_t i = shard_of(key);
+    std::shared_lock<std::shared_mutex> lock(locks_[i]);
+    return shards_[i].contains(key);
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::size_type bst_sharded<T, N, C, A>::count(const T& key) const {
+    size_t i = shard_of(key);
+    std::shared_lock<std::shared_mutex> lock(locks_[i]);
+    return shards_[i].count(key);
+}
+
+template <class T, size_t N, class C, class A>
+std::optional<T> bst_sharded<T, N, C, A>::find(const T& key) const {
+    size_t i = shard_of(key);
+    std::shared_lock<std::shared_mutex> lock(locks_[i]);
+    typename shard_type::const_iterator pos = shards_[i].find(key);
+    if (!pos.node_) return std::nullopt;
+    return *pos;
+}
+
+template <class T, size_t N, class C, class A>
+typename bst_sharded<T, N, C, A>::size_type bst_sharded<T, N, C, A>::size() const {
+    size_type res = 0;
+    for (size_t i = 0; i < N; ++i) {
+        std::shared_lock<std::shared_mutex> lock(locks_[i]);
+        res += shards_[i].size();
+    }
+    return res;
+}
+
+template <class T, size_t N, class C, class A>
+bool bst_sharded<T, N, C, A>::empty() const {
+    return size() == 0;
+}
+
+// Visits all elements in order, holding each shard's shared lock while that
+// shard is walked. The result is ordered but not a single atomic snapshot.
+template <class T, size_t N, class C, class A>
+template< class F >
+void bst_sharded<T, N, C, A>::for_each(F f) const {
+    for (size_t i = 0; i < N; ++i) {
+        std::shared_lock<std::shared_mutex> lock(locks_[i]);
+        shards_[i].for_each_chunk(256, [&f](std::span<const T> chunk) {
+            for (const T& value : chunk) f(value);
+        });
+    }
+}
@@ -0,0 +1,620 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+
+// B-tree companion to bst_in with the same interface. Every node holds up to
+// B sorted keys (inner nodes also B + 1 children), so one cache miss brings
+// in many keys, and the tree stays balanced: all leaves are at the same depth.
+// Nodes know their parent and their index in it, which lets iterators walk
+// in order and lets erase rebalance bottom-up. Like std::set, iterators stay
+// valid only until the next insert or erase.
+template <class T, class C = std::less<T>, class A = std::allocator<T>, size_t B = 32>
+class btree_in {
+private:
+    static_assert(B >= 3, "btree_in needs at least three keys per node");
+
+    struct Inner;
+    struct Node {
+        Inner *parent;
+        unsigned short count, pidx;
+        bool leaf;
+        T keys[B];
+        Node(bool);
+    };
+
+    struct Inner : Node {
+        Node *children[B + 1];
+        Inner();
+    };
+
+    static constexpr unsigned min_keys_ = (B - 1) / 2;
+
+public:
+    using key_type = T;
+    typedef  T value_type;
+    typedef typename A::size_type size_type;
+    typedef typename A::difference_type difference_type;
+    typedef  C key_compare;
+    typedef  C value_compare;
+    typedef  A allocator_type;
+    typedef const T& reference;
+    typedef const T& const_reference;
+    using AllocTraits = std::allocator_traits<A>;
+    using LeafAlloc = typename AllocTraits::template rebind_alloc<Node>;
+    using LeafAllocTraits = typename AllocTraits::template rebind_traits<Node>;
+    using InnerAlloc = typename AllocTraits::template rebind_alloc<Inner>;
+    using InnerAllocTraits = typename AllocTraits::template rebind_traits<Inner>;
+
+    class iterator {
+    public:
+        Node *node_;
+        unsigned pos_;
+        Node *root_;
+        typedef typename A::difference_type difference_type;
+        typedef  T value_type;
+        typedef const T& reference;
+        typedef const T* pointer;
+        typedef std::bidirectional_iterator_tag iterator_category;
+
+        iterator();
+        iterator(Node *, unsigned, Node *);
+
+        bool operator==(const iterator&) const;
+        bool operator!=(const iterator&) const;
+
+        iterator& operator++();
+        iterator& operator--();
+        iterator operator++(int);
+        iterator operator--(int);
+
+        reference operator*() const;
+        pointer operator->() const;
+    };
+
+    typedef iterator const_iterator;
+    typedef typename std::reverse_iterator<iterator> reverse_iterator;
+    typedef typename std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    btree_in();
+    btree_in(const btree_in&);
+    btree_in& operator=(const btree_in&);
+    ~btree_in();
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    const_reverse_iterator crbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crend() const;
+
+    void swap(btree_in&);
+    size_type max_size() const;
+    bool empty() const;
+    allocator_type get_allocator() const;
+    size_t size() const;
+    void clear();
+    std::pair<iterator, bool> insert(const value_type&);
+    iterator erase(iterator);
+    size_type erase(const T&);
+    template< class C2 >
+    void merge(btree_in<T, C2, A, B>&);
+
+    size_type count(const T&) const;
+    iterator find(const T&) const;
+    bool contains(const T&) const;
+    iterator lower_bound(const T&) const;
+    iterator upper_bound(const T&) const;
+    std::pair<iterator, iterator> equal_range(const T&) const;
+
+private:
+    Node *root_;
+    size_t size_;
+    LeafAlloc leaf_alloc_;
+    InnerAlloc inner_alloc_;
+
+    Node* make_node(bool);
+    void free_node(Node *);
+    void free_tree(Node *);
+    static Node* child(Node *, unsigned);
+    static void set_child(Inner *, unsigned, Node *);
+    static Node* leftmost(Node *);
+    static Node* rightmost(Node *);
+    void insert_at(Node *, unsigned, const T&, Node *);
+    void split(Node *);
+    void erase_at(Node *, unsigned);
+    void rebalance(Node *);
+};
+
+template <class T, class C = std::less<T>, class A = std::allocator<T>, size_t B = 32>
+void swap(btree_in<T,C,A,B>&, btree_in<T,C,A,B>&);
+
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::Node::Node(bool is_leaf): parent(nullptr), count(0), pidx(0), leaf(is_leaf), keys() {}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::Inner::Inner(): Node(false), children() {}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::iterator::iterator(): node_(nullptr), pos_(0), root_(nullptr) {}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::iterator::iterator(Node *node, unsigned pos, Node *root): node_(node), pos_(pos), root_(root) {}
+
+template<class T, class C, class A, size_t B>
+bool btree_in<T,C,A,B>::iterator::operator==(const iterator& other) const {
+    return (node_ == other.node_) && (pos_ == other.pos_);
+}
+
+template<class T, class C, class A, size_t B>
+bool btree_in<T,C,A,B>::iterator::operator!=(const iterator& other) const {
+    return !(*this == other);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator& btree_in<T,C,A,B>::iterator::operator++() {
+    if (!node_) return *this;
+
+    if (!node_->leaf) {
+        node_ = leftmost(child(node_, pos_ + 1));
+        pos_ = 0;
+        return *this;
+    }
+    if (++pos_ < node_->count) return *this;
+
+    while (node_->parent && (node_->pidx == node_->parent->count)) node_ = node_->parent;
+    if (!node_->parent) {
+        node_ = nullptr;
+        pos_ = 0;
+        return *this;
+    }
+    pos_ = node_->pidx;
+    node_ = node_->parent;
+    return *this;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator& btree_in<T,C,A,B>::iterator::operator--() {
+    if (!node_) {
+        node_ = rightmost(root_);
+        pos_ = node_->count - 1;
+        return *this;
+    }
+
+    if (!node_->leaf) {
+        node_ = rightmost(child(node_, pos_));
+        pos_ = node_->count - 1;
+        return *this;
+    }
+    if (pos_ > 0) {
+        --pos_;
+        return *this;
+    }
+
+    while (node_->parent && (node_->pidx == 0)) node_ = node_->parent;
+    if (!node_->parent) {
+        node_ = nullptr;
+        pos_ = 0;
+        return *this;
+    }
+    pos_ = node_->pidx - 1;
+    node_ = node_->parent;
+    return *this;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::iterator::operator++(int) {
+    iterator res(*this);
+    ++(*this);
+    return res;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::iterator::operator--(int) {
+    iterator res(*this);
+    --(*this);
+    return res;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator::reference btree_in<T,C,A,B>::iterator::operator*() const {
+    return node_->keys[pos_];
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator::pointer btree_in<T,C,A,B>::iterator::operator->() const {
+    return &(node_->keys[pos_]);
+}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::btree_in(): root_(nullptr), size_(0), leaf_alloc_(), inner_alloc_() {}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::btree_in(const btree_in& other): btree_in() {
+    leaf_alloc_ = other.leaf_alloc_;
+    inner_alloc_ = other.inner_alloc_;
+    for (iterator it = other.begin(); it != other.end(); ++it) insert(*it);
+}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>& btree_in<T,C,A,B>::operator=(const btree_in& other) {
+    if (this == &other) return *this;
+    btree_in copy(other);
+    swap(copy);
+    return *this;
+}
+
+template<class T, class C, class A, size_t B>
+btree_in<T,C,A,B>::~btree_in() {
+    clear();
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::Node* btree_in<T,C,A,B>::make_node(bool leaf) {
+    if (leaf) {
+        Node *node = LeafAllocTraits::allocate(leaf_alloc_, 1);
+        LeafAllocTraits::construct(leaf_alloc_, node, true);
+        return node;
+    }
+    Inner *node = InnerAllocTraits::allocate(inner_alloc_, 1);
+    InnerAllocTraits::construct(inner_alloc_, node);
+    return node;
+}
+
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::free_node(Node *node) {
+    if (node->leaf) {
+        LeafAllocTraits::destroy(leaf_alloc_, node);
+        LeafAllocTraits::deallocate(leaf_alloc_, node, 1);
+    } else {
+        Inner *inner = static_cast<Inner*>(node);
+        InnerAllocTraits::destroy(inner_alloc_, inner);
+        InnerAllocTraits::deallocate(inner_alloc_, inner, 1);
+    }
+}
+
+// Recursion depth is the tree height, which stays logarithmic.
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::free_tree(Node *node) {
+    if (!node) return;
+    if (!node->leaf) {
+        for (unsigned i = 0; i <= node->count; ++i) free_tree(child(node, i));
+    }
+    free_node(node);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::Node* btree_in<T,C,A,B>::child(Node *node, unsigned i) {
+    return static_cast<Inner*>(node)->children[i];
+}
+
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::set_child(Inner *node, unsigned i, Node *c) {
+    node->children[i] = c;
+    c->parent = node;
+    c->pidx = i;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::Node* btree_in<T,C,A,B>::leftmost(Node *node) {
+    while (!node->leaf) node = child(node, 0);
+    return node;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::Node* btree_in<T,C,A,B>::rightmost(Node *node) {
+    while (!node->leaf) node = child(node, node->count);
+    return node;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::begin() const {
+    if (!root_) return end();
+    return iterator(leftmost(root_), 0, root_);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::end() const {
+    return iterator(nullptr, 0, root_);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::const_iterator btree_in<T,C,A,B>::cbegin() const {
+    return begin();
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::const_iterator btree_in<T,C,A,B>::cend() const {
+    return end();
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::reverse_iterator btree_in<T,C,A,B>::rbegin() const {
+    return reverse_iterator(end());
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::const_reverse_iterator btree_in<T,C,A,B>::crbegin() const {
+    return const_reverse_iterator(end());
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::reverse_iterator btree_in<T,C,A,B>::rend() const {
+    return reverse_iterator(begin());
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::const_reverse_iterator btree_in<T,C,A,B>::crend() const {
+    return const_reverse_iterator(begin());
+}
+
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::swap(btree_in& other) {
+    if (this == &other) return;
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    std::swap(leaf_alloc_, other.leaf_alloc_);
+    std::swap(inner_alloc_, other.inner_alloc_);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::size_type btree_in<T,C,A,B>::max_size() const {
+    return std::numeric_limits<difference_type>::max();
+}
+
+template<class T, class C, class A, size_t B>
+bool btree_in<T,C,A,B>::empty() const {return size_ == 0;}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::allocator_type btree_in<T,C,A,B>::get_allocator() const {
+    return allocator_type(leaf_alloc_);
+}
+
+template<class T, class C, class A, size_t B>
+size_t btree_in<T,C,A,B>::size() const {return size_;}
+
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::clear() {
+    free_tree(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+// Splits a full node around its middle key, which moves up into the parent
+// (splitting the parent first if it is full as well).
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::split(Node *node) {
+    unsigned mid = B / 2;
+    Node *sibling = make_node(node->leaf);
+    std::move(node->keys + mid + 1, node->keys + B, sibling->keys);
+    sibling->count = B - mid - 1;
+    if (!node->leaf) {
+        for (unsigned i = mid + 1; i <= B; ++i) set_child(static_cast<Inner*>(sibling), i - mid - 1, child(node, i));
+    }
+    T median = std::move(node->keys[mid]);
+    node->count = mid;
+
+    if (!node->parent) {
+        Inner *root = static_cast<Inner*>(make_node(false));
+        set_child(root, 0, node);
+        root_ = root;
+    }
+    insert_at(node->parent, node->pidx, median, sibling);
+}
+
+// Inserts key at pos of node; for an inner node, right becomes the child
+// just after it.
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::insert_at(Node *node, unsigned pos, const T& key, Node *right) {
+    if (node->count == B) {
+        split(node);
+        unsigned mid = B / 2;
+        if (pos > mid) {
+            Inner *parent = node->parent;
+            node = child(parent, node->pidx + 1);
+            pos -= mid + 1;
+        }
+    }
+
+    std::move_backward(node->keys + pos, node->keys + node->count, node->keys + node->count + 1);
+    node->keys[pos] = key;
+    if (!node->leaf) {
+        Inner *inner = static_cast<Inner*>(node);
+        for (unsigned i = node->count + 1; i > pos + 1; --i) set_child(inner, i, inner->children[i - 1]);
+        set_child(inner, pos + 1, right);
+    }
+    ++node->count;
+}
+
+template<class T, class C, class A, size_t B>
+std::pair<typename btree_in<T,C,A,B>::iterator, bool> btree_in<T,C,A,B>::insert(const value_type& value) {
+    if (!root_) root_ = make_node(true);
+
+    Node *node = root_;
+    while (true) {
+        unsigned pos = std::lower_bound(node->keys, node->keys + node->count, value) - node->keys;
+        if ((pos < node->count) && (node->keys[pos] == value)) return {iterator(node, pos, root_), false};
+        if (node->leaf) {
+            bool split_needed = (node->count == B);
+            insert_at(node, pos, value, nullptr);
+            ++size_;
+            if (!split_needed) return {iterator(node, pos, root_), true};
+            return {find(value), true};
+        }
+        node = child(node, pos);
+    }
+}
+
+// Removes keys[pos] from a leaf and restores the minimum fill upwards.
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::erase_at(Node *node, unsigned pos) {
+    if (!node->leaf) {
+        Node *pred = rightmost(child(node, pos));
+        node->keys[pos] = std::move(pred->keys[pred->count - 1]);
+        node = pred;
+        pos = pred->count - 1;
+    }
+    std::move(node->keys + pos + 1, node->keys + node->count, node->keys + pos);
+    --node->count;
+    --size_;
+    rebalance(node);
+}
+
+// Fixes a node that may have dropped below min_keys_ by borrowing a key
+// through the parent from a sibling, or by merging with a sibling and
+// recursing into the parent, which lost a key.
+template<class T, class C, class A, size_t B>
+void btree_in<T,C,A,B>::rebalance(Node *node) {
+    if (!node->parent) {
+        if (node->count) return;
+        root_ = node->leaf ? nullptr : child(node, 0);
+        if (root_) root_->parent = nullptr;
+        free_node(node);
+        return;
+    }
+    if (node->count >= min_keys_) return;
+
+    Inner *parent = node->parent;
+    unsigned i = node->pidx;
+    Node *left = (i > 0) ? parent->children[i - 1] : nullptr;
+    Node *right = (i < parent->count) ? parent->children[i + 1] : nullptr;
+
+    if (left && (left->count > min_keys_)) {
+        std::move_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+        node->keys[0] = std::move(parent->keys[i - 1]);
+        parent->keys[i - 1] = std::move(left->keys[left->count - 1]);
+        if (!node->leaf) {
+            Inner *inner = static_cast<Inner*>(node);
+            for (unsigned j = node->count + 1; j > 0; --j) set_child(inner, j, inner->children[j - 1]);
+            set_child(inner, 0, child(left, left->count));
+        }
+        --left->count;
+        ++node->count;
+        return;
+    }
+    if (right && (right->count > min_keys_)) {
+        node->keys[node->count] = std::move(parent->keys[i]);
+        parent->keys[i] = std::move(right->keys[0]);
+        if (!node->leaf) {
+            Inner *inner = static_cast<Inner*>(right);
+            set_child(static_cast<Inner*>(node), node->count + 1, inner->children[0]);
+            for (unsigned j = 0; j < right->count; ++j) set_child(inner, j, inner->children[j + 1]);
+        }
+        std::move(right->keys + 1, right->keys + right->count, right->keys);
+        --right->count;
+        ++node->count;
+        return;
+    }
+
+    // Merge the pair (left, right) around separator keys[sep] of the parent.
+    if (!right) {
+        right = node;
+        node = left;
+        --i;
+    } else {
+        left = node;
+    }
+    unsigned sep = i;
+    left->keys[left->count] = std::move(parent->keys[sep]);
+    std::move(right->keys, right->keys + right->count, left->keys + left->count + 1);
+    if (!left->leaf) {
+        for (unsigned j = 0; j <= right->count; ++j) set_child(static_cast<Inner*>(left), left->count + 1 + j, child(right, j));
+    }
+    left->count += right->count + 1;
+    free_node(right);
+
+    std::move(parent->keys + sep + 1, parent->keys + parent->count, parent->keys + sep);
+    for (unsigned j = sep + 1; j < parent->count; ++j) set_child(parent, j, parent->children[j + 1]);
+    --parent->count;
+    rebalance(parent);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::erase(iterator pos) {
+    if (!pos.node_) return pos;
+    iterator next(pos);
+    ++next;
+    if (!next.node_) {
+        erase_at(pos.node_, pos.pos_);
+        return end();
+    }
+    T key = *next;
+    erase_at(pos.node_, pos.pos_);
+    return find(key);
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::size_type btree_in<T,C,A,B>::erase(const T& key) {
+    iterator pos = find(key);
+    if (!pos.node_) return 0;
+    erase_at(pos.node_, pos.pos_);
+    return 1;
+}
+
+template<class T, class C, class A, size_t B>
+template< class C2 >
+void btree_in<T,C,A,B>::merge(btree_in<T,C2,A,B>& source) {
+    for (auto it = source.begin(); it != source.end(); ++it) insert(*it);
+    source.clear();
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::size_type btree_in<T,C,A,B>::count(const T& key) const {
+    return find(key).node_ ? 1 : 0;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::find(const T& key) const {
+    iterator pos = lower_bound(key);
+    if (pos.node_ && (*pos == key)) return pos;
+    return end();
+}
+
+template<class T, class C, class A, size_t B>
+bool btree_in<T,C,A,B>::contains(const T& key) const {
+    return find(key).node_ != nullptr;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::lower_bound(const T& key) const {
+    iterator res = end();
+    Node *node = root_;
+    while (node) {
+        unsigned pos = std::lower_bound(node->keys, node->keys + node->count, key) - node->keys;
+        if (pos < node->count) {
+            res = iterator(node, pos, root_);
+            if (node->keys[pos] == key) return res;
+        }
+        if (node->leaf) break;
+        node = child(node, pos);
+    }
+    return res;
+}
+
+template<class T, class C, class A, size_t B>
+typename btree_in<T,C,A,B>::iterator btree_in<T,C,A,B>::upper_bound(const T& key) const {
+    iterator res = end();
+    Node *node = root_;
+    while (node) {
+        unsigned pos = std::upper_bound(node->keys, node->keys + node->count, key) - node->keys;
+        if (pos < node->count) res = iterator(node, pos, root_);
+        if (node->leaf) break;
+        node = child(node, pos);
+    }
+    return res;
+}
+
+template<class T, class C, class A, size_t B>
+std::pair<typename btree_in<T,C,A,B>::iterator, typename btree_in<T,C,A,B>::iterator> btree_in<T,C,A,B>::equal_range(const T& key) const {
+    return {lower_bound(key), upper_bound(key)};
+}
+
+template <class T, class C, class A, size_t B>
+void swap(btree_in<T,C,A,B>& lhs, btree_in<T,C,A,B>& rhs) {
+    lhs.swap(rhs);
+}
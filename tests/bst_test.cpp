@@ -1,8 +1,24 @@
 #include <bst_in.cpp>
 #include <bst_pre.cpp>
 #include <bst_post.cpp>
+#include <bst_mapped.cpp>
+#include <bst_sharded.cpp>
+#include <bst_rcu.cpp>
+#include <bst_persistent.cpp>
+#include <bst_concurrent.cpp>
+#include <bst_buffered.cpp>
+#include <bst_replicated.cpp>
+#include <bst_in_arena.cpp>
+#include <btree_in.cpp>
+#include <bst_link.cpp>
+#include <bst_hugepage.cpp>
 #include <gtest/gtest.h>
 #include <vector>
+#include <string>
+#include <memory_resource>
+#include <thread>
+#include <random>
+#include <algorithm>
 
 TEST(bstTestSuite, IntTest1) {
     bst_in<int> a;
@@ -111,4 +127,981 @@ TEST(bstTestSuite, StringTest) {
     }
 
     ASSERT_EQ(c, b);
-}
\ No newline at end of file
+}
+
+TEST(bstTestSuite, CopyToTest) {
+    bst_in<int> a;
+    for (int x : {5, 3, 8, 1, 4, 7, 9}) a.insert(x);
+
+    int buf[3];
+    std::vector<int> c;
+    bst_in<int>::const_iterator pos = a.cbegin();
+    size_t n;
+    while ((n = a.copy_to(std::span<int>(buf, 3), pos)) != 0) {
+        c.insert(c.end(), buf, buf + n);
+    }
+
+    std::vector<int> b = {1, 3, 4, 5, 7, 8, 9};
+    ASSERT_EQ(c, b);
+    ASSERT_TRUE(pos == a.cend());
+}
+
+TEST(bstTestSuite, ForEachChunkTest) {
+    bst_pre<int> a;
+    bst_post<int> b;
+    for (int x : {5, 3, 8, 1, 4, 7, 9}) {
+        a.insert(x);
+        b.insert(x);
+    }
+
+    std::vector<int> c, d;
+    a.for_each_chunk(2, [&](std::span<const int> chunk) {
+        ASSERT_LE(chunk.size(), 2);
+        c.insert(c.end(), chunk.begin(), chunk.end());
+    });
+    b.for_each_chunk(4, [&](std::span<const int> chunk) {
+        d.insert(d.end(), chunk.begin(), chunk.end());
+    });
+
+    std::vector<int> pre = {5, 3, 1, 4, 8, 7, 9};
+    std::vector<int> post = {1, 4, 3, 7, 9, 8, 5};
+    ASSERT_EQ(c, pre);
+    ASSERT_EQ(d, post);
+}
+
+TEST(bstTestSuite, PostOrderConstIteratorTest) {
+    bst_post<int> a, b;
+    for (int x : {10, 5, 20, 15, 17, 18}) a.insert(x);
+    for (int x : {1, 2, 3, 4}) b.insert(x);
+
+    std::vector<int> c, d;
+    for (auto it = a.cbegin(); it != a.cend(); ++it) c.push_back(*it);
+    for (auto it = b.cbegin(); it != b.cend(); ++it) d.push_back(*it);
+
+    std::vector<int> post_a = {5, 18, 17, 15, 20, 10};
+    std::vector<int> post_b = {4, 3, 2, 1};
+    ASSERT_EQ(c, post_a);
+    ASSERT_EQ(d, post_b);
+}
+
+TEST(bstTestSuite, IteratorConceptTest) {
+    static_assert(std::bidirectional_iterator<bst_in<int>::iterator>);
+    static_assert(std::bidirectional_iterator<bst_in<int>::const_iterator>);
+    static_assert(std::bidirectional_iterator<bst_pre<int>::iterator>);
+    static_assert(std::bidirectional_iterator<bst_post<int>::const_iterator>);
+    static_assert(std::forward_iterator<bst_pre<int>::range_iterator>);
+    static_assert(std::ranges::view<decltype(std::declval<bst_in<int>&>().subrange(0, 1))>);
+
+    bst_in<int> a;
+    a.insert(2);
+    a.insert(1);
+    auto it = a.begin();
+    ASSERT_EQ(*(it++), 1);
+    ASSERT_EQ(*it, 2);
+    ASSERT_EQ(*(it--), 2);
+    ASSERT_EQ(*it, 1);
+}
+
+TEST(bstTestSuite, SubrangeTest) {
+    bst_in<int> a;
+    bst_pre<int> b;
+    bst_post<int> c;
+    for (int x : {5, 3, 8, 1, 4, 7, 9, 6}) {
+        a.insert(x);
+        b.insert(x);
+        c.insert(x);
+    }
+
+    std::vector<int> d, e, f, g;
+    for (int x : a.subrange(3, 8)) d.push_back(x);
+    for (int x : a.subrange(3, 8) | std::views::reverse) e.push_back(x);
+    for (int x : b.subrange(4, 8)) f.push_back(x);
+    for (int x : c.subrange(4, 8)) g.push_back(x);
+
+    ASSERT_EQ(d, std::vector<int>({3, 4, 5, 6, 7}));
+    ASSERT_EQ(e, std::vector<int>({7, 6, 5, 4, 3}));
+    ASSERT_EQ(f, std::vector<int>({5, 4, 7, 6}));
+    ASSERT_EQ(g, std::vector<int>({4, 6, 7, 5}));
+    ASSERT_TRUE(a.subrange(8, 3).empty());
+    ASSERT_TRUE(b.subrange(10, 20).empty());
+}
+
+TEST(bstTestSuite, SerializeTest) {
+    bst_pre<int> a;
+    for (int i = 0; i < 20000; ++i) a.insert((i * 7919) % 20011);
+
+    FILE *file = std::tmpfile();
+    int fd = fileno(file);
+    ASSERT_TRUE(a.serialize(fd));
+    off_t length = lseek(fd, 0, SEEK_CUR);
+    lseek(fd, 0, SEEK_SET);
+
+    bst_pre<int> b;
+    b.insert(-1);
+    ASSERT_TRUE(b.deserialize(fd));
+    ASSERT_EQ(a.size(), b.size());
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+    ASSERT_EQ(*(--b.end()), *(--a.end()));
+
+    ASSERT_EQ(ftruncate(fd, length - 3), 0);
+    lseek(fd, 0, SEEK_SET);
+    bst_pre<int> c;
+    ASSERT_FALSE(c.deserialize(fd));
+    ASSERT_TRUE(c.empty());
+    std::fclose(file);
+}
+
+TEST(bstTestSuite, MappedTest) {
+    bst_in<int> a;
+    for (int i = 0; i < 1000; ++i) a.insert((i * 37) % 1000 * 2);
+
+    char path[] = "/tmp/bst_mapped_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_TRUE(bst_mapped<int>::write(fd, a.begin(), a.size()));
+    close(fd);
+
+    bst_mapped<int> b;
+    ASSERT_TRUE(b.open(path));
+    unlink(path);
+
+    ASSERT_EQ(b.size(), a.size());
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+    ASSERT_TRUE(std::equal(a.rbegin(), a.rend(), b.rbegin(), b.rend()));
+    ASSERT_TRUE(b.contains(500));
+    ASSERT_FALSE(b.contains(501));
+    ASSERT_EQ(*b.lower_bound(501), 502);
+    ASSERT_EQ(*b.upper_bound(502), 504);
+    ASSERT_TRUE(b.find(5000) == b.end());
+    ASSERT_TRUE(b.lower_bound(1999) == b.end());
+}
+
+TEST(bstTestSuite, MappedCorruptTest) {
+    bst_in<int> a;
+    for (int i = 0; i < 100; ++i) a.insert((i * 37) % 100);
+
+    char path[] = "/tmp/bst_mapped_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_TRUE(bst_mapped<int>::write(fd, a.begin(), a.size()));
+    off_t length = lseek(fd, 0, SEEK_END);
+    std::vector<unsigned char> image(length);
+    ASSERT_EQ(pread(fd, image.data(), length, 0), length);
+
+    // Header is magic, value size, count, root; the nodes follow it and a
+    // node is value, left, right, prev.
+    auto corrupt = [&](size_t at, uint64_t word, off_t size) {
+        std::vector<unsigned char> bad(image);
+        std::memcpy(bad.data() + at, &word, sizeof(word));
+        ASSERT_EQ(pwrite(fd, bad.data(), size, 0), size);
+        ASSERT_EQ(ftruncate(fd, size), 0);
+    };
+    // open() checks the header and the root only.
+    auto rejected = [&](size_t at, uint64_t word, off_t size) {
+        corrupt(at, word, size);
+        bst_mapped<int> b;
+        ASSERT_FALSE(b.open(path));
+        ASSERT_TRUE(b.empty());
+    };
+    // Bad links further down open fine and throw once they are followed.
+    auto throws = [&](size_t at, uint64_t word, off_t size) {
+        corrupt(at, word, size);
+        bst_mapped<int> b;
+        ASSERT_TRUE(b.open(path));
+        ASSERT_FALSE(b.verify());
+        ASSERT_THROW(std::vector<int>(b.begin(), b.end()), std::runtime_error);
+        ASSERT_THROW(std::vector<int>(b.rbegin(), b.rend()), std::runtime_error);
+    };
+    uint64_t root;
+    std::memcpy(&root, image.data() + 24, sizeof(root));
+    rejected(24, length + 4096, length);
+    rejected(24, root + 1, length);
+    rejected(24, 8, length);
+    rejected(root + 24, root, length);
+    rejected(0, 0x31504d4d545342ull, length / 2);
+    throws(root + 8, 1u << 20, length);
+    throws(root + 8, root + 2, length);
+    throws(root + 8, root, length);
+    throws(root + 16, root + 8 + 32, length);
+    // A truncated file whose count was patched to fit.
+    throws(16, 60, length - 40 * 32);
+
+    ASSERT_EQ(pwrite(fd, image.data(), length, 0), length);
+    ASSERT_EQ(ftruncate(fd, length), 0);
+    close(fd);
+    bst_mapped<int> b;
+    ASSERT_TRUE(b.open(path));
+    unlink(path);
+    ASSERT_TRUE(b.verify());
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+}
+
+TEST(bstTestSuite, ClearIncrementalTest) {
+    bst_in<int> a;
+    for (int i = 0; i < 10000; ++i) a.insert(i);
+
+    ASSERT_FALSE(a.clear_incremental(100));
+    ASSERT_TRUE(a.empty());
+    ASSERT_TRUE(a.begin() == a.end());
+
+    a.insert(5);
+    a.insert(3);
+    ASSERT_EQ(*a.begin(), 3);
+
+    int calls = 1;
+    while (!a.clear_incremental(100)) ++calls;
+    ASSERT_GE(calls, 100);
+    ASSERT_TRUE(a.empty());
+
+    bst_post<int> b;
+    for (int i = 0; i < 1000; ++i) b.insert(i % 2 ? i : -i);
+    b.clear_incremental(10);
+}
+
+TEST(bstTestSuite, InsertBulkTest) {
+    bst_in<int> a;
+    for (int i = 0; i < 1000; i += 3) a.insert(i);
+
+    std::vector<int> batch;
+    for (int i = 0; i < 50000; ++i) batch.push_back((i * 7919) % 20000);
+    ASSERT_EQ(a.insert_bulk(batch.begin(), batch.end()), 20000 - 334);
+    ASSERT_EQ(a.size(), 20000);
+    ASSERT_EQ(a.insert_bulk(batch.begin(), batch.begin() + 100), 0);
+
+    int expected = 0;
+    for (auto it = a.begin(); it != a.end(); ++it) ASSERT_EQ(*it, expected++);
+    ASSERT_EQ(expected, 20000);
+    ASSERT_EQ(*(--a.end()), 19999);
+}
+
+TEST(bstTestSuite, SetOperationsTest) {
+    bst_in<int> a, b;
+    for (int i = 0; i < 1000; i += 2) a.insert((i * 37) % 1000);
+    for (int i = 0; i < 1000; i += 3) b.insert((i * 41) % 999);
+
+    a.set_union(b);
+    ASSERT_TRUE(b.empty());
+    ASSERT_EQ(a.size(), 500 + 333 - 167);
+    int prev = -1;
+    for (auto it = a.begin(); it != a.end(); ++it) {
+        ASSERT_LT(prev, *it);
+        ASSERT_TRUE((*it % 2 == 0) || (*it % 3 == 0));
+        prev = *it;
+    }
+
+    bst_in<int> c, d;
+    for (int i = 0; i < 1000; i += 5) c.insert(i);
+    for (int i = 999; i >= 0; i -= 2) d.insert(i);
+    bst_in<int> e;
+    for (int i = 0; i < 1000; i += 5) e.insert(i);
+
+    a.set_intersection(c);
+    ASSERT_TRUE(c.empty());
+    ASSERT_EQ(a.size(), 100 + 67 - 34);
+    for (auto it = a.begin(); it != a.end(); ++it) ASSERT_TRUE((*it % 10 == 0) || (*it % 15 == 0));
+
+    a.set_difference(d);
+    ASSERT_TRUE(d.empty());
+    ASSERT_EQ(a.size(), 100);
+    e.set_difference(a);
+    ASSERT_EQ(e.size(), 100);
+    for (auto it = e.begin(); it != e.end(); ++it) ASSERT_EQ(*it % 10, 5);
+
+    // Inputs this large fork onto threads near the top.
+    std::vector<int> keys(1 << 15);
+    for (size_t i = 0; i < keys.size(); ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+    bst_in<int> f, g;
+    for (int key : keys) {
+        f.insert(key * 2);
+        g.insert(key * 3);
+    }
+    f.set_intersection(g);
+    ASSERT_EQ(f.size(), ((1 << 16) + 5) / 6);
+    for (auto it = f.begin(); it != f.end(); ++it) ASSERT_EQ(*it % 6, 0);
+}
+
+TEST(bstTestSuite, SplitJoinTest) {
+    bst_in<int> a, b;
+    for (int i = 0; i < 1000; ++i) a.insert((i * 37) % 1000);
+    a.split(600, b);
+    ASSERT_EQ(a.size(), 600);
+    ASSERT_EQ(b.size(), 400);
+    ASSERT_EQ(*(--a.end()), 599);
+    ASSERT_EQ(*b.begin(), 600);
+    a.insert(2000);
+    b.erase(600);
+    ASSERT_EQ(a.size(), 601);
+    ASSERT_EQ(b.size(), 399);
+    a.erase(2000);
+
+    b.join(a);
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQ(b.size(), 999);
+    int expected = 0;
+    for (auto it = b.begin(); it != b.end(); ++it, ++expected) {
+        if (expected == 600) ++expected;
+        ASSERT_EQ(*it, expected);
+    }
+
+    bst_pre<int> c, d;
+    for (int i = 0; i < 100; ++i) c.insert((i * 37) % 100);
+    c.split(50, d);
+    ASSERT_EQ(c.size(), 50);
+    ASSERT_EQ(d.size(), 50);
+    for (auto it = d.begin(); it != d.end(); ++it) ASSERT_GE(*it, 50);
+    c.join(d);
+    ASSERT_EQ(c.size(), 100);
+    ASSERT_TRUE(c.contains(0) && c.contains(99));
+
+    bst_post<int> e, f;
+    for (int i = 0; i < 100; ++i) e.insert(i);
+    e.split(0, f);
+    ASSERT_TRUE(e.empty());
+    ASSERT_EQ(f.size(), 100);
+    for (int i = 100; i < 150; ++i) e.insert(i);
+    f.join(e);
+    ASSERT_EQ(f.size(), 150);
+
+    // The first size() after a split recounts; concurrent const calls may
+    // both do so.
+    bst_in<int> g, h;
+    for (int i = 0; i < 10000; ++i) g.insert((i * 7919) % 10000);
+    g.split(5000, h);
+    const bst_in<int>& view = g;
+    size_t sizes[4];
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) readers.emplace_back([&view, &sizes, t] { sizes[t] = view.size(); });
+    for (std::thread& thread : readers) thread.join();
+    for (size_t size : sizes) ASSERT_EQ(size, 5000);
+}
+
+TEST(bstTestSuite, BufferedTest) {
+    bst_buffered<int> a(16);
+    for (int i = 0; i < 100; ++i) a.insert(i);
+    ASSERT_LT(a.pending(), 16);
+    ASSERT_TRUE(a.contains(99));
+
+    a.erase(50);
+    a.insert(50);
+    a.erase(50);
+    a.erase(1000);
+    ASSERT_FALSE(a.contains(50));
+    ASSERT_TRUE(a.contains(49));
+    ASSERT_EQ(a.size(), 99);
+    ASSERT_EQ(a.pending(), 0);
+
+    a.insert(50);
+    ASSERT_TRUE(a.find(50) != a.end());
+    int expected = 0;
+    for (auto it = a.begin(); it != a.end(); ++it) ASSERT_EQ(*it, expected++);
+    ASSERT_EQ(expected, 100);
+}
+
+TEST(bstTestSuite, ReplicatedTest) {
+    bst_replicated<int, bst_thread_placement> a(bst_thread_placement(3), 64);
+    ASSERT_EQ(a.replicas(), 3);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&a, t] {
+            for (int i = t; i < 2000; i += 4) {
+                ASSERT_TRUE(a.insert(i));
+                ASSERT_TRUE(a.contains(i));
+                if (i % 3 == 0) {
+                    ASSERT_EQ(a.erase(i), 1);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    ASSERT_EQ(a.size(), 2000 - 667);
+    ASSERT_FALSE(a.insert(1));
+    ASSERT_EQ(a.find(2).value(), 2);
+    ASSERT_FALSE(a.find(3).has_value());
+    int visited = 0;
+    a.for_each([&visited](int value) { ASSERT_NE(value % 3, 0); ++visited; });
+    ASSERT_EQ(visited, 2000 - 667);
+
+    bst_replicated<int> b;
+    ASSERT_GE(b.replicas(), 1);
+    b.insert(5);
+    ASSERT_TRUE(b.contains(5));
+}
+
+TEST(bstTestSuite, ReplicatedRaceTest) {
+    // One group, so readers keep syncing the replica that writers report from.
+    bst_replicated<int, bst_thread_placement> a(bst_thread_placement(1), 16);
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> readers, writers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&a, &done, t] {
+            while (!done.load()) {
+                a.contains(t);
+                a.sync();
+            }
+        });
+    }
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&a, t] {
+            for (int round = 0; round < 2000; ++round) {
+                for (int i = t; i < 32; i += 4) ASSERT_TRUE(a.insert(i));
+                for (int i = t; i < 32; i += 4) ASSERT_EQ(a.erase(i), 1);
+            }
+        });
+    }
+    for (std::thread& thread : writers) thread.join();
+    done.store(true);
+    for (std::thread& thread : readers) thread.join();
+    ASSERT_TRUE(a.empty());
+}
+
+TEST(bstTestSuite, ArenaTest) {
+    bst_in_arena<uint32_t> a;
+    auto first = a.insert(500).first;
+    for (uint32_t i = 0; i < 1000; ++i) a.insert((i * 37) % 1000);
+    ASSERT_EQ(*first, 500);
+    ASSERT_EQ(a.size(), 1000);
+    ASSERT_GE(a.capacity(), 1000);
+
+    for (uint32_t i = 0; i < 1000; i += 2) ASSERT_EQ(a.erase(i), 1);
+    ASSERT_EQ(a.erase(0), 0);
+    size_t capacity = a.capacity();
+    for (uint32_t i = 1000; i < 1500; ++i) a.insert(i);
+    ASSERT_EQ(a.capacity(), capacity);
+
+    uint32_t expected = 1;
+    for (auto it = a.begin(); it != a.end(); ++it) {
+        ASSERT_EQ(*it, expected);
+        expected += (expected < 999) ? 2 : 1;
+    }
+    ASSERT_EQ(*(--a.end()), 1499);
+    ASSERT_EQ(*a.lower_bound(500), 501);
+    ASSERT_EQ(*a.upper_bound(501), 503);
+    ASSERT_TRUE(a.find(500) == a.end());
+
+    bst_in_arena<uint32_t> b(a);
+    a.clear();
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQ(b.size(), 1000);
+    ASSERT_TRUE(b.contains(1499));
+}
+
+TEST(bstTestSuite, RelayoutTest) {
+    bst_in<int> a;
+    for (int i = 0; i < 1000; ++i) a.insert((i * 37) % 1000);
+    a.relayout();
+    ASSERT_EQ(a.size(), 1000);
+    int expected = 0;
+    for (auto it = a.begin(); it != a.end(); ++it) ASSERT_EQ(*it, expected++);
+    ASSERT_EQ(*(--a.end()), 999);
+
+    for (int i = 0; i < 1000; i += 2) a.erase(i);
+    for (int i = 1000; i < 1100; ++i) a.insert(i);
+    a.relayout();
+    ASSERT_EQ(a.size(), 600);
+    ASSERT_TRUE(a.contains(1099) && a.contains(1) && !a.contains(2));
+
+    bst_in<int> b;
+    b.insert(a.extract(a.find(501)));
+    ASSERT_TRUE(b.contains(501));
+    a.split(700, b);
+    ASSERT_EQ(b.size(), 250);
+    a.clear_incremental(10);
+    a.insert(5);
+    a.relayout();
+    ASSERT_EQ(*a.begin(), 5);
+}
+
+TEST(bstTestSuite, BtreeTest) {
+    btree_in<int, std::less<int>, std::allocator<int>, 4> a;
+    for (int i = 0; i < 1000; ++i) ASSERT_TRUE(a.insert((i * 37) % 1000).second);
+    ASSERT_FALSE(a.insert(5).second);
+    ASSERT_EQ(a.size(), 1000);
+
+    int expected = 0;
+    for (auto it = a.begin(); it != a.end(); ++it) ASSERT_EQ(*it, expected++);
+    for (auto it = a.rbegin(); it != a.rend(); ++it) ASSERT_EQ(*it, --expected);
+
+    for (int i = 0; i < 1000; i += 2) ASSERT_EQ(a.erase(i), 1);
+    ASSERT_EQ(a.size(), 500);
+    ASSERT_EQ(*a.lower_bound(500), 501);
+    ASSERT_EQ(*a.upper_bound(501), 503);
+    ASSERT_TRUE(a.find(500) == a.end());
+    ASSERT_EQ(*a.erase(a.find(501)), 503);
+
+    btree_in<int, std::less<int>, std::allocator<int>, 4> b;
+    for (int i = 0; i < 10; ++i) b.insert(-i);
+    a.merge(b);
+    ASSERT_TRUE(b.empty());
+    ASSERT_EQ(*a.begin(), -9);
+    while (!a.empty()) a.erase(a.begin());
+    ASSERT_TRUE(a.begin() == a.end());
+}
+
+TEST(bstTestSuite, LinkTest) {
+    struct Item {
+        int value;
+        bst_link<Item> next;
+    };
+    ASSERT_EQ(sizeof(bst_link<Item>), sizeof(Item *));
+
+    Item a{1, nullptr}, b{2, nullptr};
+    a.next = &b;
+    a.next.set(1, true);
+    ASSERT_EQ(a.next.tag(), 2u);
+    ASSERT_EQ(a.next->value, 2);
+    ASSERT_EQ(a.next, &b);
+
+    b.next.set_tag(1);
+    a.next = b.next;
+    ASSERT_TRUE(a.next == nullptr);
+    ASSERT_TRUE(a.next.test(1));
+    ASSERT_FALSE(a.next.test(0));
+
+    a.next = &a;
+    b.next = &b;
+    std::swap(a.next, b.next);
+    ASSERT_EQ(a.next.get(), &b);
+    ASSERT_EQ(a.next.tag(), 2u);
+    ASSERT_EQ(b.next.get(), &a);
+    ASSERT_EQ(b.next.tag(), 1u);
+}
+
+TEST(bstTestSuite, MemoryUsageTest) {
+    typedef bst_counting_allocator<int> counting;
+    counting alloc;
+    bst_in<int, std::less<int>, counting> a(alloc);
+    for (int i = 0; i < 1000; ++i) a.insert((i * 37) % 1000);
+
+    bst_memory_usage usage = a.memory_usage();
+    ASSERT_EQ(usage.nodes, 1000);
+    ASSERT_EQ(usage.value_bytes, 1000 * sizeof(int));
+    ASSERT_GT(usage.node_bytes, usage.value_bytes);
+    ASSERT_GT(usage.slack_bytes, 0);
+    ASSERT_EQ(usage.auxiliary_bytes, sizeof(a));
+
+    bst_allocation_stats stats = alloc.stats();
+    ASSERT_EQ(stats.live_allocations, 1000);
+    ASSERT_EQ(stats.live_bytes, usage.node_bytes);
+    ASSERT_EQ(stats.peak_bytes, usage.node_bytes);
+    ASSERT_EQ(a.get_allocator().stats().allocations, 1000);
+
+    a.relayout();
+    stats = alloc.stats();
+    ASSERT_EQ(stats.live_allocations, 2);
+    ASSERT_EQ(stats.live_bytes, usage.node_bytes + a.memory_usage().auxiliary_bytes - sizeof(a));
+    ASSERT_GE(stats.peak_bytes, 2 * usage.node_bytes);
+
+    a.clear_incremental(10);
+    usage = a.memory_usage();
+    ASSERT_EQ(usage.nodes, 0);
+    ASSERT_GT(usage.auxiliary_bytes, sizeof(a));
+    while (!a.clear_incremental(100)) {}
+    ASSERT_EQ(a.memory_usage().auxiliary_bytes, sizeof(a));
+    ASSERT_EQ(alloc.stats().live_bytes, 0);
+
+    bst_pre<int, std::less<int>, counting> b(alloc);
+    bst_post<int, std::less<int>, counting> c(alloc);
+    for (int i = 0; i < 100; ++i) {
+        b.insert(i);
+        c.insert(i);
+    }
+    ASSERT_EQ(b.memory_usage().nodes, 100);
+    ASSERT_EQ(c.memory_usage().node_bytes, b.memory_usage().node_bytes);
+    ASSERT_EQ(alloc.stats().live_allocations, 200);
+}
+
+TEST(bstTestSuite, CompactTest) {
+    typedef bst_counting_allocator<int> counting;
+    counting alloc;
+    bst_in<int, std::less<int>, counting> a(alloc);
+    std::vector<int> expected;
+    for (int i = 0; i < 20000; ++i) a.insert((i * 7919) % 20011);
+    for (int i = 0; i < 20011; ++i) {
+        if (i % 3) a.erase(i);
+        else if (a.contains(i)) expected.push_back(i);
+    }
+
+    size_t calls = 0;
+    while (!a.compact(1000)) {
+        if (++calls == 3) {
+            a.insert(1);
+            a.erase(3);
+            expected.erase(expected.begin() + 1);
+            expected.insert(expected.begin() + 1, 1);
+        }
+    }
+    ASSERT_GT(calls, 3);
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), expected.begin(), expected.end()));
+    ASSERT_TRUE(std::equal(a.rbegin(), a.rend(), expected.rbegin(), expected.rend()));
+    ASSERT_EQ(a.size(), expected.size());
+    // One block, the block table and the node inserted behind the cursor.
+    ASSERT_EQ(alloc.stats().live_allocations, 3);
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (i % 4) a.erase(expected[i]);
+    }
+    ASSERT_TRUE(a.compact(expected.size()));
+    ASSERT_EQ(alloc.stats().live_allocations, 2);
+    for (size_t i = 0; i < expected.size(); i += 4) ASSERT_TRUE(a.contains(expected[i]));
+    ASSERT_EQ(a.size(), (expected.size() + 3) / 4);
+
+    bst_in<int, std::less<int>, counting> b(alloc);
+    a.split(expected[expected.size() / 2], b);
+    a.join(b);
+    ASSERT_EQ(a.size(), (expected.size() + 3) / 4);
+
+    // A small tree gets a block sized to it, not a full chunk_bytes_ one.
+    counting small_alloc;
+    bst_in<int, std::less<int>, counting> c(small_alloc);
+    for (int i = 0; i < 50; ++i) c.insert((i * 17) % 50);
+    size_t before = small_alloc.stats().live_bytes;
+    ASSERT_TRUE(c.compact(50));
+    ASSERT_EQ(small_alloc.stats().live_allocations, 2);
+    ASSERT_LE(small_alloc.stats().live_bytes, before + 256);
+    for (int i = 0; i < 50; ++i) ASSERT_TRUE(c.contains(i));
+}
+
+TEST(bstTestSuite, CompactReleaseTest) {
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__) || !defined(__GLIBC__)
+    GTEST_SKIP() << "measures the resident size of the glibc heap";
+#else
+    auto resident = [] {
+        long pages = 0, rss = 0;
+        FILE *file = std::fopen("/proc/self/statm", "r");
+        if (!file || std::fscanf(file, "%ld %ld", &pages, &rss) != 2) rss = 0;
+        if (file) std::fclose(file);
+        return rss * sysconf(_SC_PAGESIZE);
+    };
+
+    // Random order, then 90% erased: every page of nodes keeps a few live
+    // ones, so nothing is returned to the OS until the survivors move.
+    std::vector<int> keys(400000);
+    for (size_t i = 0; i < keys.size(); ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(11));
+    bst_in<int> a;
+    for (int key : keys) a.insert(key);
+    for (int key : keys) {
+        if (key % 10) a.erase(key);
+    }
+    long before = resident();
+
+    while (!a.compact(4096)) {}
+    long after = resident();
+    ASSERT_LT(after, before - (8 << 20));
+    ASSERT_EQ(a.size(), keys.size() / 10);
+    for (int key = 0; key < 400000; key += 10) ASSERT_TRUE(a.contains(key));
+#endif
+}
+
+template <class Tree>
+void check_update_key() {
+    typedef bst_counting_allocator<int> counting;
+    counting alloc;
+    Tree a(alloc);
+    std::vector<int> keys;
+    for (int i = 0; i < 2000; ++i) {
+        a.insert((i * 7919) % 20011);
+        keys.push_back((i * 7919) % 20011);
+    }
+    size_t allocations = alloc.stats().allocations;
+
+    for (int i = 0; i < 5000; ++i) {
+        size_t at = (i * 31) % keys.size();
+        int value = (i % 3) ? keys[at] + 1 : (i * 104729) % 20011;
+        auto pos = a.find(keys[at]);
+        auto res = a.update_key(pos, value);
+        if (std::find(keys.begin(), keys.end(), value) != keys.end()) {
+            ASSERT_EQ(*res.first, value);
+            ASSERT_EQ(res.second, value == keys[at]);
+        } else {
+            ASSERT_TRUE(res.second);
+            ASSERT_TRUE(res.first == pos);
+            keys[at] = value;
+        }
+        ASSERT_EQ(*pos, keys[at]);
+    }
+    ASSERT_EQ(alloc.stats().allocations, allocations);
+
+    std::sort(keys.begin(), keys.end());
+    std::vector<int> visited;
+    a.for_each_chunk(64, [&visited](std::span<const int> chunk) { visited.insert(visited.end(), chunk.begin(), chunk.end()); });
+    std::sort(visited.begin(), visited.end());
+    ASSERT_TRUE(std::equal(keys.begin(), keys.end(), visited.begin(), visited.end()));
+    ASSERT_EQ(a.size(), keys.size());
+    for (int key : keys) ASSERT_TRUE(a.contains(key));
+}
+
+TEST(bstTestSuite, UpdateKeyTest) {
+    typedef bst_counting_allocator<int> counting;
+    check_update_key<bst_in<int, std::less<int>, counting>>();
+    check_update_key<bst_pre<int, std::less<int>, counting>>();
+    check_update_key<bst_post<int, std::less<int>, counting>>();
+}
+
+TEST(bstTestSuite, PmrTest) {
+    alignas(std::max_align_t) unsigned char buffer[1 << 16];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    {
+        bst_pmr::bst_in<int> a(&arena);
+        bst_pmr::bst_pre<int> b(&arena);
+        bst_pmr::bst_post<int> c(&arena);
+        for (int i = 0; i < 500; ++i) {
+            a.insert((i * 37) % 500);
+            b.insert((i * 37) % 500);
+            c.insert((i * 37) % 500);
+        }
+        a.erase(5);
+        ASSERT_EQ(a.size(), 499);
+        ASSERT_EQ(b.size(), 500);
+        ASSERT_TRUE(c.contains(499));
+        ASSERT_EQ(*a.begin(), 0);
+    }
+
+    {
+        bst_pmr::bst_in<std::string> a(&arena);
+        for (int i = 0; i < 50; ++i) a.insert(std::string(64, 'a' + i % 26) + std::to_string(i));
+        ASSERT_EQ(a.size(), 50);
+
+        bst_pmr::bst_post<std::pmr::string> b(&arena);
+        for (int i = 0; i < 50; ++i) b.insert(std::pmr::string(64, 'a' + i % 26, &arena));
+        ASSERT_EQ(b.size(), 26);
+        ASSERT_EQ(b.begin()->get_allocator().resource(), &arena);
+    }
+
+    std::pmr::unsynchronized_pool_resource pool;
+    bst_pmr::bst_in<int> d(&pool);
+    for (int i = 0; i < 1000; ++i) d.insert(i);
+    for (int i = 0; i < 1000; i += 2) d.erase(i);
+    ASSERT_EQ(d.size(), 500);
+    ASSERT_EQ(d.get_allocator().resource(), &pool);
+
+    // The aliases must not clash with std::pmr under a using-directive.
+    {
+        using namespace std;
+        pmr::unsynchronized_pool_resource local;
+        bst_pmr::bst_pre<int> e(&local);
+        e.insert(1);
+        ASSERT_TRUE(e.contains(1));
+    }
+}
+
+TEST(bstTestSuite, HugepageTest) {
+    typedef bst_hugepage_allocator<int> huge;
+    auto arena = std::make_shared<bst_hugepage_arena>(size_t(4) << 20);
+    bst_in<int, std::less<int>, huge> a{huge(arena)};
+    for (int i = 0; i < 200000; ++i) a.insert((i * 7919) % 200003);
+    for (int i = 0; i < 200003; i += 2) a.erase(i);
+    for (int i = 0; i < 1000; ++i) a.insert(i * 2);
+    ASSERT_EQ(a.size(), 101000);
+    for (int i = 0; i < 2000; ++i) ASSERT_TRUE(a.contains(i));
+
+    bst_hugepage_stats stats = a.get_allocator().stats();
+    ASSERT_EQ(stats.live_objects + stats.fallback_objects, a.size());
+    ASSERT_LE(stats.huge_objects, stats.live_objects);
+    if (stats.reserved_bytes) {
+        ASSERT_EQ(stats.reserved_bytes % bst_hugepage_arena::huge_page, 0);
+        ASSERT_LE(stats.touched_bytes, stats.reserved_bytes);
+        ASSERT_LE(stats.huge_bytes, stats.reserved_bytes);
+    }
+
+    a.clear();
+    ASSERT_EQ(a.get_allocator().stats().live_objects, 0);
+}
+
+template <class Tree>
+void check_relinking_erase() {
+    Tree a;
+    const int n = 3000;
+    for (int i = 0; i < n; ++i) a.insert((i * 7919) % n);
+    const int *address[n];
+    for (int i = 0; i < n; ++i) address[i] = &*a.find(i);
+
+    for (int i = 0; i < n; i += 2) {
+        int key = (i * 31) % n;
+        auto pos = a.find(key);
+        size_t index = std::distance(a.begin(), pos);
+        auto next = a.erase(pos);
+        ASSERT_EQ(std::distance(a.begin(), next), index);
+        address[key] = nullptr;
+    }
+    ASSERT_EQ(a.size(), n / 2);
+    for (int i = 0; i < n; ++i) {
+        if (address[i]) ASSERT_EQ(&*a.find(i), address[i]);
+        else ASSERT_FALSE(a.contains(i));
+    }
+
+    Tree b;
+    for (int i = 1; i < n; i += 4) {
+        auto& node = a.extract(i);
+        ASSERT_TRUE(b.insert(node).second);
+        ASSERT_EQ(&*b.find(i), address[i]);
+    }
+    ASSERT_EQ(a.size() + b.size(), n / 2);
+    ASSERT_EQ(a.erase(3), 1);
+    ASSERT_EQ(a.erase(3), 0);
+    for (int i = 7; i < n; i += 4) ASSERT_TRUE(a.contains(i));
+}
+
+TEST(bstTestSuite, RelinkingEraseTest) {
+    check_relinking_erase<bst_in<int>>();
+    check_relinking_erase<bst_pre<int>>();
+    check_relinking_erase<bst_post<int>>();
+}
+
+template <class Tree>
+void check_deep_copy() {
+    Tree a;
+    for (int i : {50, 20, 80, 10, 30, 70, 90, 25}) a.insert(i);
+    Tree b(a);
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+    ASSERT_NE(&*a.find(30), &*b.find(30));
+    b.erase(30);
+    ASSERT_TRUE(a.contains(30));
+    Tree c;
+    c.insert(1);
+    c = b;
+    c = c;
+    b.clear();
+    ASSERT_EQ(c.size(), a.size() - 1);
+    ASSERT_FALSE(c.contains(1));
+    ASSERT_TRUE(c.contains(25));
+}
+
+TEST(bstTestSuite, DeepCopyTest) {
+    check_deep_copy<bst_in<int>>();
+    check_deep_copy<bst_pre<int>>();
+    check_deep_copy<bst_post<int>>();
+}
+
+TEST(bstTestSuite, ShardedTest) {
+    bst_sharded<int, 4> a({1000, 2000, 3000});
+    ASSERT_EQ(a.shard_of(-5), 0);
+    ASSERT_EQ(a.shard_of(1000), 1);
+    ASSERT_EQ(a.shard_of(3500), 3);
+    ASSERT_THROW((bst_sharded<int, 4>({1000, 2000})), std::invalid_argument);
+    ASSERT_THROW((bst_sharded<int, 4>({1000, 2000, 3000, 4000})), std::invalid_argument);
+    ASSERT_THROW((bst_sharded<int, 4>({1000, 3000, 2000})), std::invalid_argument);
+    ASSERT_THROW((bst_sharded<int, 4>({1000, 1000, 2000})), std::invalid_argument);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&a, t] {
+            for (int i = t; i < 4000; i += 4) a.insert((i * 1237) % 4000);
+            for (int i = t; i < 4000; i += 4) {
+                if (!a.contains((i * 1237) % 4000)) std::abort();
+            }
+            for (int i = t; i < 4000; i += 8) a.erase((i * 1237) % 4000);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    ASSERT_EQ(a.size(), 2000);
+    std::vector<int> b(a.begin(), a.end()), c;
+    a.for_each([&c](int x) { c.push_back(x); });
+    ASSERT_EQ(b, c);
+    ASSERT_TRUE(std::is_sorted(b.begin(), b.end()));
+    ASSERT_EQ(a.find(b[0]), b[0]);
+    ASSERT_FALSE(a.find(-1).has_value());
+}
+
+TEST(bstTestSuite, RcuTest) {
+    bst_rcu<int> a;
+    for (int i = 0; i < 1000; i += 2) a.insert(i);
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&a, &done] {
+            while (!done.load()) {
+                for (int i = 0; i < 1000; i += 2) {
+                    if (!a.contains(i)) std::abort();
+                }
+                int prev = -1;
+                a.for_each([&prev](int x) {
+                    if (x <= prev) std::abort();
+                    prev = x;
+                });
+            }
+        });
+    }
+
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 1; i < 1000; i += 2) a.insert(i);
+        for (int i = 1; i < 1000; i += 2) a.erase(i);
+    }
+    done.store(true);
+    for (std::thread& thread : readers) thread.join();
+
+    ASSERT_EQ(a.size(), 500);
+    ASSERT_EQ(a.find(4), 4);
+    ASSERT_FALSE(a.find(5).has_value());
+    ASSERT_EQ(a.lower_bound(5), 6);
+    ASSERT_EQ(a.erase(500), 1);
+    ASSERT_FALSE(a.contains(500));
+    a.clear();
+    ASSERT_TRUE(a.empty());
+}
+
+TEST(bstTestSuite, PersistentTest) {
+    bst_persistent<int> a;
+    for (int x : {5, 3, 8, 1, 4, 7, 9}) a.insert(x);
+
+    bst_persistent<int> b = a.snapshot();
+    auto it = b.find(4);
+    a.erase(4);
+    a.erase(5);
+    a.insert(6);
+    a.clear();
+    a.insert(100);
+
+    ASSERT_EQ(*it, 4);
+    ASSERT_EQ(*(++it), 5);
+    ASSERT_EQ(*(--b.end()), 9);
+    std::vector<int> c(b.begin(), b.end());
+    ASSERT_EQ(c, std::vector<int>({1, 3, 4, 5, 7, 8, 9}));
+    ASSERT_EQ(b.size(), 7);
+    ASSERT_EQ(a.size(), 1);
+
+    bst_persistent<int> d = b.snapshot();
+    d.erase(5);
+    d.erase(1);
+    d.insert(2);
+    std::vector<int> e(d.rbegin(), d.rend());
+    ASSERT_EQ(e, std::vector<int>({9, 8, 7, 4, 3, 2}));
+    ASSERT_TRUE(b.contains(5));
+    ASSERT_EQ(*b.lower_bound(6), 7);
+    ASSERT_TRUE(b.upper_bound(9) == b.end());
+}
+
+TEST(bstTestSuite, ConcurrentTest) {
+    bst_concurrent<int> a;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&a, t] {
+            for (int round = 0; round < 3; ++round) {
+                for (int i = t; i < 2000; i += 8) a.insert((i * 811) % 2000);
+                for (int i = t; i < 2000; i += 8) {
+                    if (!a.contains((i * 811) % 2000)) std::abort();
+                }
+                for (int i = t; i < 2000; i += 16) a.erase((i * 811) % 2000);
+                for (int i = 0; i < 200; ++i) {
+                    a.insert(2000 + (i * 7 + t) % 50);
+                    a.erase(2000 + (i * 11 + t) % 50);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (int i = 2000; i < 2050; ++i) a.erase(i);
+    std::vector<int> b;
+    a.for_each([&b](int x) { b.push_back(x); });
+    ASSERT_EQ(a.size(), 1000);
+    ASSERT_EQ(b.size(), 1000);
+    ASSERT_TRUE(std::is_sorted(b.begin(), b.end()));
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(a.contains((i * 811) % 2000), i % 16 >= 8);
+    }
+}